@@ -1,6 +1,7 @@
 // ======================================================================== //
 // SPECTRAL TO COLOUR CONVERTER                                             //
 // Calculates RGB values from spectral information.                         //
+// Command line client of libspectocol.                                     //
 //                                                                          //
 // Author: Sebastian Schimper                                               //
 // ======================================================================== //
@@ -10,67 +11,17 @@
 #include <stdbool.h>
 #include <ctype.h>
 #include <getopt.h>
-#include <assert.h>
-#include <math.h>
-#include <time.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <errno.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/un.h>
 
-// ========================================================
-// Definition of the sizes of the tables used later
-// Stuct for representing wavelength and intensity values
-// ========================================================
-#define TABLE_SIZE 1000 + 1
-#define VISIBLE_SPECTRUM_LOWER_BOUND 380
-#define VISIBLE_SPECTRUM_UPPER_BOUND 780
-#define NOT_IN_TABLE -10000000000
-#define EMEMENT_COUNT_MAX 30
-#define PI 3.14159265
-
-// struct holding single wavelength-intensity-pair
-typedef struct node{
-    float wavelength;
-    double intensity;
-    struct node *next;
-} node;
-
-typedef struct linkedList {
-    struct node *head;
-    int count;
-} linkedList;
-
-
-// luminaire data containers
-struct linkedList *cie_incandescent = NULL;
-struct linkedList *cie_daylight = NULL;
-struct linkedList *f11 = NULL;
-
-// reflectance data containers
-struct linkedList *xrite_e2 = NULL;
-struct linkedList *xrite_f4 = NULL;
-struct linkedList *xrite_g4 = NULL;
-struct linkedList *xrite_h4 = NULL;
-struct linkedList *xrite_j4 = NULL;
-struct linkedList *xrite_a1 = NULL;
-
-// cie matching functions container
-struct linkedList *cie_x = NULL;
-struct linkedList *cie_y = NULL;
-struct linkedList *cie_z = NULL;
-
-// used functions
-struct linkedList *l_func;
-struct linkedList *r_func;
-
-// ========================================================
-// GLOBAL VARIABLES
-// - transformation matrix and containers for data
-// ========================================================
+#include "spectocol.h"
 
-// used for conversion from CIE XYZ -> sRGB
-const float transformation_matrix[3][3] = {
-        {3.2410, -1.5374, -0.4986},
-        {-0.9692, 1.8760, 0.0416},
-        {0.0556, -0.2050, 1.0570}
-};
+#define DATA_DIRECTORIES_MAX 16
 
 // ========================================================
 // print a nice header
@@ -97,747 +48,655 @@ void printLine(void) {
     printf("-------------------------------------------------------------------------------------\n");
 }
 
+
 // ========================================================
-// DICTIONARY DATA STRUCTURE stuff
+// the actual main part of this homework assignment
+// calculation and conversion from spectral information
+// to colour, the work is done by libspectocol
 // ========================================================
-// construct linkedList value
-// simply convert float to int
-unsigned int getlinkedListIndex(const float wl) {
-    int wl_int = wl;
-    assert(wl_int >= VISIBLE_SPECTRUM_LOWER_BOUND && wl_int <= VISIBLE_SPECTRUM_UPPER_BOUND);
-    return wl_int - VISIBLE_SPECTRUM_LOWER_BOUND;
-}
-
-// create one node
-struct node *createNode(const float wl, const double in) {
-    struct node *newNode;
-    newNode = (struct node *)malloc(sizeof(struct node));
-    newNode->wavelength = wl;
-    newNode->intensity = in;
-    newNode->next = NULL;
-
-    return newNode;
-}
-
-// partially stolen from here: https://www.geeksforgeeks.org/insertion-sort-for-singly-linked-list/
-void addNodeToTable(struct linkedList *table, const float wl, const double in) {
-    unsigned int slot = getlinkedListIndex(wl);
-    struct node* newNode = createNode(wl, in);
-
-    // check head of bucket list
-    if(!table[slot].head) {
-        table[slot].head = newNode;
-        table[slot].count = 1;
-        return;
-    }
+bool setFunctionsFromInput(spectocolContext *ctx, char* l_func_s, char* r_func_s,
+                           const spectocolSpectrum **l_func, const spectocolSpectrum **r_func) {
 
-    // add new node to the list and update head
-    struct node **head_ref = &table[slot].head;
-    struct node *current;
-    /* Special case for the head end */
-    if ((*head_ref) == NULL || (*head_ref)->wavelength >= newNode->wavelength)
-    {
-        newNode->next = *head_ref;
-        *head_ref = newNode;
+    // set l function
+    *l_func = spectocolFindSpectrum(ctx, l_func_s, SPECTOCOL_LUMINAIRE);
+    if(!*l_func) {
+        printf("Couldn't find l_function: Wrong arguments...\n");
+        return false;
     }
-    else
-    {
-        /* Locate the node before the point of insertion */
-        current = *head_ref;
-        while (current->next!=NULL &&
-               current->next->wavelength < newNode->wavelength)
-        {
-            current = current->next;
-        }
-        newNode->next = current->next;
-        current->next = newNode;
+
+    // set r function
+    *r_func = spectocolFindSpectrum(ctx, r_func_s, SPECTOCOL_REFLECTANCE);
+    if(!*r_func) {
+        printf("Couldn't find r_function: Wrong arguments...\n");
+        return false;
     }
-    table[slot].count++;
+    return true;
 }
 
-void addNodeToFixedTable(struct linkedList *table, const int index, const float wl, const double in) {
-    unsigned int slot = index;
-    struct node* newNode = createNode(wl, in);
+// convert and print the result, name is the method as shown to the user
+void printConversion(spectocolContext *ctx, spectocolMethod method, const char *name, int num_samples,
+                     const spectocolSpectrum *l_func, const spectocolSpectrum *r_func) {
+    float rgb[3];
+    spectocolStatus status = spectocolConvert(ctx, method, num_samples, l_func, r_func, NULL, rgb);
 
-    // check head of bucket list
-    if(!table[slot].head) {
-        table[slot].head = newNode;
-        table[slot].count = 1;
-        return;
-    }
+    printLine();
+    if(status == SPECTOCOL_OK)
+        printf("Result of %s WL sampling: R(%.5f) G(%.5f) B(%.5f)\n", name, rgb[0], rgb[1], rgb[2]);
     else
-        printf("Not added.. Wl -> %.1f  In -> %.05f\n", wl, in);
+        printf("%s WL sampling failed: %s\n", name, spectocolStatusMessage(status));
+    printLine();
 }
 
-// look up a wavelength and get the corresponding intensity
-// takes value and container as input arguments
-double lookupAtWl(struct linkedList *table, const float wl) {
-    unsigned int slot = getlinkedListIndex(wl);
-    struct node *wantedNode;
-    wantedNode = table[slot].head;
+void rndWavelengthSampling(spectocolContext *ctx, int num_samples, char* l_func_s, char* r_func_s) {
+    printf("Random wavelength (incl. hero) sampling with %d samples,\n"
+           "luminare function %s,\n"
+           "and reflectance function %s...\n", num_samples, l_func_s, r_func_s);
 
-    if(!wantedNode) {
-        // printf("Search element with wl %.0f unavailable in linkedList table\n", wl);
-        return NOT_IN_TABLE;
-    }
+    const spectocolSpectrum *l_func, *r_func;
+    if(!setFunctionsFromInput(ctx, l_func_s, r_func_s, &l_func, &r_func))
+        return;
 
-    while(wantedNode != NULL) {
-        if(wantedNode->wavelength == wl) {
-            return wantedNode->intensity;
-        }
-        wantedNode = wantedNode->next;
-    }
+    printConversion(ctx, SPECTOCOL_RANDOM, "random", num_samples, l_func, r_func);
+    printConversion(ctx, SPECTOCOL_HERO, "hero", num_samples, l_func, r_func);
 }
 
-double lookupAtIndex(struct linkedList *table, const int i) {
-    unsigned int slot = i;
-    struct node *wantedNode;
-    wantedNode = table[slot].head;
+void fxdWavelengthSampling(spectocolContext *ctx, int num_samples, char* l_func_s, char* r_func_s) {
+    printf("Fixed wavelength sampling with %d samples,\n"
+           "luminare function %s,\n"
+           "and reflectance function %s...\n", num_samples, l_func_s, r_func_s);
 
-    if(!wantedNode) {
-        // printf("Search element with wl %.0f unavailable in linkedList table\n", wl);
-        return NOT_IN_TABLE;
-    }
-    else {
-        return wantedNode->intensity;
+    if(num_samples > SPECTOCOL_FIXED_SAMPLES_MAX) {
+        printf("Number of samples for fixed wavelength sampling is too high. Please choose a value smaller than %d.\n", SPECTOCOL_FIXED_SAMPLES_MAX);
+        exit(0);
     }
+
+    const spectocolSpectrum *l_func, *r_func;
+    if(!setFunctionsFromInput(ctx, l_func_s, r_func_s, &l_func, &r_func))
+        return;
+
+    printConversion(ctx, SPECTOCOL_FIXED, "fixed", num_samples, l_func, r_func);
 }
 
-// stolen from here: http://see-programming.blogspot.com/2013/05/chain-linkedListing-separate-chaining-with.html
-void deleteFromlinkedList(struct linkedList *table, const float wl) {
-    int flag = 0;
-    unsigned int slot = getlinkedListIndex(wl);
-    struct node *temp, *currentNode;
-    /* get the list head from current bucket */
-    currentNode = table[slot].head;
-    if (!currentNode) {
-        printf("Given data is not present in linkedList Table!!\n");
+// sample until the estimate reaches a target precision, max_samples = 0 for the default budget
+void targetWavelengthSampling(spectocolContext *ctx, double target_error, double target_delta_e, long max_samples,
+                              char* l_func_s, char* r_func_s) {
+    printf("Streaming random wavelength sampling until ");
+    if(target_error > 0)
+        printf("a standard error of %g%s", target_error, target_delta_e > 0 ? " or " : "");
+    if(target_delta_e > 0)
+        printf("a delta E of %g", target_delta_e);
+    printf(",\n"
+           "luminare function %s,\n"
+           "and reflectance function %s...\n", l_func_s, r_func_s);
+
+    const spectocolSpectrum *l_func, *r_func;
+    if(!setFunctionsFromInput(ctx, l_func_s, r_func_s, &l_func, &r_func))
         return;
-    }
-    temp = currentNode;
-    while (currentNode != NULL) {
-        /* delete the node with given key */
-        if (currentNode->wavelength == wl) {
-            flag = 1;
-            if (currentNode == table[slot].head)
-                table[slot].head = currentNode->next;
-            else
-                temp->next = currentNode->next;
 
-            table[slot].count--;
-            free(currentNode);
-            break;
-        }
-        temp = currentNode;
-        currentNode = currentNode->next;
+    spectocolEstimate estimate;
+    spectocolStatus status = spectocolConvertToTarget(ctx, l_func, r_func, target_error, target_delta_e,
+                                                      max_samples, &estimate);
+    printLine();
+    if(status != SPECTOCOL_OK) {
+        printf("streaming WL sampling failed: %s\n", spectocolStatusMessage(status));
+    } else {
+        printf("Result of streaming WL sampling: R(%.5f) G(%.5f) B(%.5f)\n",
+               estimate.rgb[0], estimate.rgb[1], estimate.rgb[2]);
+        printf("%s after %ld samples, standard error X(%.5f) Y(%.5f) Z(%.5f), delta E %.4f\n",
+               estimate.converged ? "Converged" : "Sample budget used up", estimate.num_samples,
+               estimate.standard_error[0], estimate.standard_error[1], estimate.standard_error[2],
+               estimate.delta_e);
     }
-    if(!flag)
-        printf("Given data with WL %.3f is not present in linkedList Table.\n", wl);
-    return;
+    printLine();
 }
 
-// delete whole table
-void deleteTable(struct linkedList *table) {
-    struct node *currentNode;
-    int i;
-    for (i = VISIBLE_SPECTRUM_LOWER_BOUND; i <= VISIBLE_SPECTRUM_UPPER_BOUND; i++) {
-        const unsigned int slot = getlinkedListIndex(i);
-        if (table[slot].count == 0)
-            continue;
-        currentNode = table[slot].head;
-        if (!currentNode)
-            continue;
-        while (currentNode != NULL) {
-            deleteFromlinkedList(table, currentNode->wavelength);
-            currentNode = currentNode->next;
-        }
-    }
-    return;
+void cmpWavelengthSampling(spectocolContext *ctx, int num_samples, char* l_func_s, char* r_func_s) {
+    fxdWavelengthSampling(ctx, num_samples, l_func_s, r_func_s);
+    rndWavelengthSampling(ctx, num_samples, l_func_s, r_func_s);
 }
 
-// helper function to print content of table
-void printFunction(struct linkedList *table) {
-    struct node *myNode;
-    int i;
-    for (i = VISIBLE_SPECTRUM_LOWER_BOUND; i <= VISIBLE_SPECTRUM_UPPER_BOUND; i++) {
-        const unsigned int slot = getlinkedListIndex(i);
-        if (table[slot].count == 0)
-            continue;
-        myNode = table[slot].head;
-        if (!myNode)
-            continue;
-        printf("\nData at index %d in linkedList Table:\n", i);
-        printf("Wavel           Intens\n");
-        printf("----------------------\n");
-        while (myNode != NULL) {
-            printf("%.6f      ", myNode->wavelength);
-            printf("%.6f\n", myNode->intensity);
-            myNode = myNode->next;
-        }
-    }
-    return;
+// ========================================================
+// batch mode - convert many luminaire/reflectance pairs
+// listed in a manifest file, one job per line:
+//      luminaire,reflectance,method,samples
+// where method is one of fixed/random/hero.
+// Tables are read and interpolated only once per process.
+// ========================================================
+#define BATCH_LINE_MAX 512
+#define BATCH_NAME_MAX 30
+
+// strip the blanks and line endings around a line or field of a job in place
+char *trimField(char *s) {
+    s += strspn(s, " \t\r\n");
+    size_t length = strlen(s);
+    while(length > 0 && strchr(" \t\r\n", s[length - 1]))
+        length--;
+    s[length] = '\0';
+    return s;
 }
 
-void printIntFunc(struct linkedList *table, int count, char *name) {
-    printf("%s \n ========= \n", name);
-    for(int i = 0; i < count; i++) {
-        struct linkedList *thisNode = &table[i];
-        printf("%d %.0f %.6f\n", i, thisNode->head->wavelength, thisNode->head->intensity);
+typedef struct batchJob {
+    char luminaire[BATCH_NAME_MAX];
+    char reflectance[BATCH_NAME_MAX];
+    char method[BATCH_NAME_MAX];
+    bool inline_refl;   // the reflectance was given inline and belongs to the job
+} batchJob;
+
+// number of worker threads for batch mode, 0 = one per core
+int num_threads = 0;
+
+// parse a spectrum given inline as "[wl value; wl value; ...]"
+// returns NULL and a reason in error if the text is malformed
+spectocolSpectrum *parseInlineSpectrum(spectocolContext *ctx, const char *text, char *error, const size_t error_size) {
+    const char *p = text;
+    while(isspace((unsigned char)*p))
+        p++;
+    if(*p != '[') {
+        snprintf(error, error_size, "inline spectrum must start with '['");
+        return NULL;
     }
-}
+    p++;
+
+    int count = 0;
+    int capacity = 64;
+    double *wavelength = (double *)malloc(capacity * sizeof(double));
+    double *intensity = (double *)malloc(capacity * sizeof(double));
+
+    bool closed = false;
+    while(*p != '\0' && !closed) {
+        char *end;
+        double wl = strtod(p, &end);
+        if(end == p)
+            break;
+        p = end;
+        while(*p == ' ' || *p == '\t' || *p == ':')
+            p++;
+        double in = strtod(p, &end);
+        if(end == p)
+            break;
+        p = end;
 
-// helper function to write a table to a txt file
-void printFunctionToFile(char* filename, struct linkedList *table, int count) {
+        if(count == capacity) {
+            capacity *= 2;
+            wavelength = (double *)realloc(wavelength, capacity * sizeof(double));
+            intensity = (double *)realloc(intensity, capacity * sizeof(double));
+        }
+        wavelength[count] = wl;
+        intensity[count++] = in;
+
+        while(*p == ' ' || *p == '\t' || *p == ';')
+            p++;
+        if(*p == ']') {
+            closed = true;
+            p++;
+        }
+    }
+    while(isspace((unsigned char)*p))
+        p++;
+
+    spectocolSpectrum *spectrum = NULL;
+    if(!closed || *p != '\0')
+        snprintf(error, error_size, "expected wavelength-intensity-pairs in [wl value; ...] near '%.20s'", p);
+    else if(!(spectrum = spectocolCreateSpectrum(ctx, wavelength, intensity, count)))
+        snprintf(error, error_size, "inline spectrum has no sample inside the spectral grid");
+
+    free(wavelength);
+    free(intensity);
+    return spectrum;
+}
 
-    FILE * data_file = fopen(filename, "r");
-    if(data_file != NULL) {
-        remove(data_file);
+// parse and validate a single job, returns false and the reason in error if the job is malformed
+// the reflectance is either a name or an inline spectrum, see parseInlineSpectrum
+bool parseBatchJob(spectocolContext *ctx, char *line, batchJob *job, spectocolRequest *request,
+                   char *error, const size_t error_size) {
+    char *fields[4];
+    int field_count = 0;
+    char *save;     // strtok_r, server clients parse jobs concurrently
+    char *token = strtok_r(line, ",", &save);
+    while(token != NULL && field_count < 4) {
+        fields[field_count++] = trimField(token);
+        token = strtok_r(NULL, ",", &save);
     }
 
-    data_file = fopen(filename, "a");
-    if(data_file == NULL) {
-        printf("Error: No file was found, and a new file couldn't be created.\n");
-        return;
+    if(field_count != 4 || token != NULL) {
+        snprintf(error, error_size, "expected luminaire,reflectance,method,samples");
+        return false;
     }
 
-    if(count == 0) {
-        for(int i = VISIBLE_SPECTRUM_LOWER_BOUND; i <= VISIBLE_SPECTRUM_UPPER_BOUND; i++) {
-            double lookedUpIn;
-            lookedUpIn = lookupAtWl(table, i);
+    request->luminaire = spectocolFindSpectrum(ctx, fields[0], SPECTOCOL_LUMINAIRE);
+    request->reflectance = NULL;
+    request->num_samples = atoi(fields[3]);
+    job->inline_refl = fields[1][0] == '[';
+    char *method = fields[2];
 
-            if(lookedUpIn != NOT_IN_TABLE) {
-                fprintf(data_file, "%3i %11f\n", i, lookedUpIn);
-            }
+    if(!request->luminaire) {
+        snprintf(error, error_size, "unknown luminaire '%s'", fields[0]);
+        return false;
+    }
+
+    if(strcmp(method, "fixed") == 0) {
+        request->method = SPECTOCOL_FIXED;
+        if(request->num_samples < 2 || request->num_samples > SPECTOCOL_FIXED_SAMPLES_MAX) {
+            snprintf(error, error_size, "fixed sampling needs between 2 and %d samples", SPECTOCOL_FIXED_SAMPLES_MAX);
+            return false;
         }
     }
-    else {
-        for(int i = 0; i < count; i++) {
-            double lookedUpIn;
-            linkedList *thisNode = &table[i];
-
-            if(thisNode != NULL) {
-                float wl = thisNode->head->wavelength;
-                double in = thisNode->head->intensity;
-                fprintf(data_file, "%f %.6f\n", wl, in);
-            }
+    else if(strcmp(method, "random") == 0 || strcmp(method, "hero") == 0) {
+        request->method = method[0] == 'r' ? SPECTOCOL_RANDOM : SPECTOCOL_HERO;
+        if(request->num_samples < 1) {
+            snprintf(error, error_size, "number of samples must be positive");
+            return false;
         }
     }
+    else {
+        snprintf(error, error_size, "unknown method '%s'", method);
+        return false;
+    }
 
-    fclose(data_file);
+    if(job->inline_refl)
+        request->reflectance = parseInlineSpectrum(ctx, fields[1], error, error_size);
+    else if(!(request->reflectance = spectocolFindSpectrum(ctx, fields[1], SPECTOCOL_REFLECTANCE)))
+        snprintf(error, error_size, "unknown reflectance '%s'", fields[1]);
+    if(!request->reflectance)
+        return false;
+
+    snprintf(job->luminaire, BATCH_NAME_MAX, "%s", fields[0]);
+    snprintf(job->reflectance, BATCH_NAME_MAX, "%s", job->inline_refl ? "inline" : fields[1]);
+    snprintf(job->method, BATCH_NAME_MAX, "%s", method);
+    return true;
 }
-// ========================================================
-// interpolation stuff
-// ========================================================
-// http://paulbourke.net/miscellaneous/interpolation/
-double cosineInterpolate(
-        double y1,double y2,
-        double mu)
-{
-    double mu2;
 
-    mu2 = (1-cos(mu*PI))/2;
-    return(y1*(1-mu2)+y2*mu2);
+// free what parseBatchJob allocated for the job
+void clearBatchJob(batchJob *job, spectocolRequest *request) {
+    if(job->inline_refl)
+        spectocolDeleteSpectrum((spectocolSpectrum *)request->reflectance);
+    request->reflectance = NULL;
 }
 
-void interpolateTableInt(linkedList *table) {
-    int x1, x2, j;
-
-    if(lookupAtWl(table, VISIBLE_SPECTRUM_UPPER_BOUND) == NOT_IN_TABLE) {
-        addNodeToTable(table, VISIBLE_SPECTRUM_UPPER_BOUND, 0.0);
+// process every job in the manifest on all cores, results go to stdout in manifest order
+void batchWavelengthSampling(spectocolContext *ctx, char *manifest_filename) {
+    FILE *manifest = fopen(manifest_filename, "r");
+    if(manifest == NULL) {
+        printf("Manifest file %s could not be opened.\n", manifest_filename);
+        return;
     }
 
-    for(int i = VISIBLE_SPECTRUM_LOWER_BOUND; i < VISIBLE_SPECTRUM_UPPER_BOUND; i++) {
-        if(lookupAtWl(table, i) == NOT_IN_TABLE) {
-            x1 = i - 1;
-            j = i + 1;
+    // lines of any length, inline spectra can be long
+    char *line = NULL;
+    size_t line_size = 0;
+    int line_number = 0;
+    int failed_jobs = 0;
 
-            while(j < VISIBLE_SPECTRUM_UPPER_BOUND && lookupAtWl(table, j) == NOT_IN_TABLE) {
-                j++;
-            }
-            x2 = j;
+    int job_count = 0;
+    int job_capacity = 64;
+    batchJob *jobs = (batchJob *)malloc(job_capacity * sizeof(batchJob));
+    spectocolRequest *requests = (spectocolRequest *)malloc(job_capacity * sizeof(spectocolRequest));
 
-            float d = x2 - x1;
-            double y1 = lookupAtWl(table, x1);
-            double y2 = lookupAtWl(table, x2);
+    while(getline(&line, &line_size, manifest) != -1) {
+        line_number++;
+        char *job = trimField(line);
 
-            float p = 1.0;
-            for(int k = x1 + 1; k < x2; k++) {
-                double result = cosineInterpolate(y1, y2, (p/d));
-                addNodeToTable(table, k, result);
-                p = p + 1.0;
-            }
-            i = j;
+        // skip empty lines and comments
+        if(job[0] == '\0' || job[0] == '#')
+            continue;
+
+        if(job_count == job_capacity) {
+            job_capacity *= 2;
+            jobs = (batchJob *)realloc(jobs, job_capacity * sizeof(batchJob));
+            requests = (spectocolRequest *)realloc(requests, job_capacity * sizeof(spectocolRequest));
         }
-    }
-}
-// ========================================================
-// integration
-// ========================================================
-float integrate_uniform(linkedList *table, const int count, const int delta) {
 
-    float result = 0;
-    for(int i = 0; i < count - 1; i++) {
-        float currentIn = table[i].head->intensity;
-        float nextIn = table[i+1].head->intensity;
-        result += ((currentIn + nextIn) / 2) * delta;
+        char error[BATCH_LINE_MAX];
+        if(parseBatchJob(ctx, job, &jobs[job_count], &requests[job_count], error, sizeof(error))) {
+            job_count++;
+        }
+        else {
+            fprintf(stderr, "Line %d: %s\n", line_number, error);
+            failed_jobs++;
+        }
     }
-    return result;
-}
+    free(line);
+    fclose(manifest);
 
-float integrate_nonuniform(linkedList *table, const int count) {
+    spectocolConvertBatch(ctx, requests, job_count, num_threads);
 
-    float result = 0;
-    for(int i = 0; i < count - 1; i++) {
-        float currentWl = table[i].head->wavelength;
-        float nextWl = table[i+1].head->wavelength;
-        float currentIn = table[i].head->intensity;
-        float nextIn = table[i+1].head->intensity;
-        result += ((currentIn + nextIn) / 2) * (nextWl - currentWl);
+    printf("luminaire,reflectance,method,samples,r,g,b\n");
+    for(int i = 0; i < job_count; i++) {
+        printf("%s,%s,%s,%d,%.5f,%.5f,%.5f\n", jobs[i].luminaire, jobs[i].reflectance, jobs[i].method,
+               requests[i].num_samples, requests[i].rgb[0], requests[i].rgb[1], requests[i].rgb[2]);
+        clearBatchJob(&jobs[i], &requests[i]);
     }
-    return result;
-}
+    free(jobs);
+    free(requests);
 
+    if(failed_jobs > 0)
+        fprintf(stderr, "%d job(s) in %s could not be processed.\n", failed_jobs, manifest_filename);
+}
 
 // ========================================================
-// multiplication
+// all pairs mode - every reflectance of a list under every
+// luminaire of a list, see spectocolConvertAll
 // ========================================================
-void convertToRgb(float cie_vec[3], float res[3])
-{
-    int i, j;
-    for (i = 0; i < 3; i++)
-    {
-        res[i] = 0;
-        for (j = 0; j < 3; j++)
-        {
-            res[i] += transformation_matrix[i][j] * cie_vec[j];
+// split a comma separated list of names in place and find the spectra, false if one is unknown
+bool findSpectrumList(spectocolContext *ctx, char *list, spectocolKind kind, char ***names,
+                      const spectocolSpectrum ***spectra, int *count) {
+    int capacity = 16;
+    *names = (char **)malloc(capacity * sizeof(char *));
+    *spectra = (const spectocolSpectrum **)malloc(capacity * sizeof(spectocolSpectrum *));
+    *count = 0;
+    char *save;
+    for(char *name = strtok_r(list, ",", &save); name != NULL; name = strtok_r(NULL, ",", &save)) {
+        if(*count == capacity) {
+            capacity *= 2;
+            *names = (char **)realloc(*names, capacity * sizeof(char *));
+            *spectra = (const spectocolSpectrum **)realloc(*spectra, capacity * sizeof(spectocolSpectrum *));
+        }
+        name = trimField(name);
+        (*names)[*count] = name;
+        if(!((*spectra)[*count] = spectocolFindSpectrum(ctx, name, kind))) {
+            printf("Unknown %s '%s'.\n", kind == SPECTOCOL_LUMINAIRE ? "luminaire" : "reflectance", name);
+            return false;
         }
+        (*count)++;
     }
+    return *count > 0;
 }
-// ========================================================
-// randomness
-// ========================================================
-int getRandomNumber() {
-    int r = random() % 400 + 1;
-    return r + VISIBLE_SPECTRUM_LOWER_BOUND;
+
+// fixed sampling of all pairs on all cores, results go to stdout as csv, reflectance by reflectance
+void allPairsWavelengthSampling(spectocolContext *ctx, int num_samples, char *luminaire_list, char *reflectance_list) {
+    char **luminaire_names = NULL, **reflectance_names = NULL;
+    const spectocolSpectrum **luminaires = NULL, **reflectances = NULL;
+    int luminaire_count = 0, reflectance_count = 0;
+
+    if(findSpectrumList(ctx, luminaire_list, SPECTOCOL_LUMINAIRE, &luminaire_names, &luminaires, &luminaire_count)
+       && findSpectrumList(ctx, reflectance_list, SPECTOCOL_REFLECTANCE, &reflectance_names, &reflectances,
+                           &reflectance_count)) {
+        size_t size = (size_t)luminaire_count * reflectance_count * 3 * sizeof(float);
+        float *xyz = (float *)malloc(size);
+        float *rgb = (float *)malloc(size);
+        spectocolStatus status = spectocolConvertAll(ctx, num_samples, luminaires, luminaire_count, reflectances,
+                                                     reflectance_count, xyz, rgb, num_threads);
+        if(status != SPECTOCOL_OK) {
+            printf("All pairs conversion failed: %s.\n", spectocolStatusMessage(status));
+        }
+        else {
+            printf("luminaire,reflectance,samples,x,y,z,r,g,b\n");
+            for(int i = 0; i < reflectance_count; i++) {
+                for(int m = 0; m < luminaire_count; m++) {
+                    const float *x = xyz + 3 * ((size_t)i * luminaire_count + m);
+                    const float *c = rgb + 3 * ((size_t)i * luminaire_count + m);
+                    printf("%s,%s,%d,%.5f,%.5f,%.5f,%.5f,%.5f,%.5f\n", luminaire_names[m], reflectance_names[i],
+                           num_samples, x[0], x[1], x[2], c[0], c[1], c[2]);
+                }
+            }
+        }
+        free(xyz);
+        free(rgb);
+    }
+    free(luminaire_names);
+    free(reflectance_names);
+    free(luminaires);
+    free(reflectances);
 }
 
 // ========================================================
-// sorting
+// server mode - keep the tables in memory and answer
+// conversion requests on a unix domain socket. Every
+// request is one line in the batch manifest format,
+//      luminaire,reflectance,method,samples
+// where reflectance may be an inline spectrum, and gets
+// one line back: x,y,z,r,g,b or "error: reason".
+// Each client is served by its own thread.
 // ========================================================
-void swap(linkedList *xp, linkedList *yp)
-{
-    linkedList temp = *xp;
-    *xp = *yp;
-    *yp = temp;
+#define SERVER_BACKLOG 64
+#define SERVER_REQUEST_MAX (64 * 1024)
+
+typedef struct conversionServer {
+    spectocolContext *ctx;
+    int listen_fd;
+    int *clients;       // connected sockets, shut down when the server stops
+    int client_count;
+    int client_capacity;
+    pthread_mutex_t lock;
+    pthread_cond_t clients_done;
+} conversionServer;
+
+conversionServer server = {NULL, -1, NULL, 0, 0, PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER};
+volatile sig_atomic_t server_stopping = 0;
+
+void stopServer(int signal_number) {
+    (void)signal_number;
+    server_stopping = 1;
 }
 
-// Function to perform Selection Sort
-void selectionSort(linkedList *table, int n)
-{
-    int i, j, min_idx;
-
-    // One by one move boundary of unsorted subarray
-    for (i = 0; i < n - 1; i++) {
-
-        // Find the minimum element in unsorted array
-        min_idx = i;
-        for (j = i + 1; j < n; j++)
-            if (table[j].head->wavelength < table[min_idx].head->wavelength)
-                min_idx = j;
-
-        // Swap the found minimum element
-        // with the first element
-        swap(&table[min_idx], &table[i]);
+void addClient(const int fd) {
+    pthread_mutex_lock(&server.lock);
+    if(server.client_count == server.client_capacity) {
+        server.client_capacity = server.client_capacity ? server.client_capacity * 2 : 16;
+        server.clients = (int *)realloc(server.clients, server.client_capacity * sizeof(int));
     }
+    server.clients[server.client_count++] = fd;
+    pthread_mutex_unlock(&server.lock);
 }
 
-// ========================================================
-// point-wise multiplication
-// ========================================================
-struct linkedList *pointwiseMultipication(const linkedList *a, const linkedList *b, const int count) {
-
-    size_t n = count;
-
-    linkedList *res = (struct linkedList *)calloc(n, sizeof (struct linkedList));
-
-    for(int i = 0; i < n; i++) {
-        assert(a[i].head->wavelength == b[i].head->wavelength);
-        double mult_res = a[i].head->intensity * b[i].head->intensity;
-        addNodeToFixedTable(res, i, a[i].head->wavelength, mult_res);
+void removeClient(const int fd) {
+    pthread_mutex_lock(&server.lock);
+    for(int i = 0; i < server.client_count; i++) {
+        if(server.clients[i] == fd) {
+            server.clients[i] = server.clients[--server.client_count];
+            break;
+        }
     }
-    return res;
+    pthread_cond_signal(&server.clients_done);
+    pthread_mutex_unlock(&server.lock);
 }
 
-// ========================================================
-// prepossessing stuff: init tables and
-// read the pairs of wavelength and intensity
-// takes the filename and the container the files
-// shall be placed in
-// ========================================================
-// initialize all containers
-void initDataContainers(void) {
-    // luminaire data
-    cie_incandescent = (struct linkedList *)calloc(TABLE_SIZE, sizeof (struct linkedList));
-    cie_daylight = (struct linkedList *)calloc(TABLE_SIZE, sizeof (struct linkedList));
-    f11 = (struct linkedList *)calloc(TABLE_SIZE, sizeof (struct linkedList));
-
-    // reflectance data containers
-    xrite_e2 = (struct linkedList *)calloc(TABLE_SIZE, sizeof (struct linkedList));
-    xrite_f4 = (struct linkedList *)calloc(TABLE_SIZE, sizeof (struct linkedList));
-    xrite_g4 = (struct linkedList *)calloc(TABLE_SIZE, sizeof (struct linkedList));
-    xrite_h4 = (struct linkedList *)calloc(TABLE_SIZE, sizeof (struct linkedList));
-    xrite_j4 = (struct linkedList *)calloc(TABLE_SIZE, sizeof (struct linkedList));
-    xrite_a1 = (struct linkedList *)calloc(TABLE_SIZE, sizeof (struct linkedList));
-
-    // cie matching functions container
-    cie_x = (struct linkedList *)calloc(TABLE_SIZE, sizeof (struct linkedList));
-    cie_y = (struct linkedList *)calloc(TABLE_SIZE, sizeof (struct linkedList));
-    cie_z = (struct linkedList *)calloc(TABLE_SIZE, sizeof (struct linkedList));
-
-}
-
-// read filenames
-void readFile(char* filename, struct linkedList* table) {
-
-    FILE * data_file = fopen(filename, "r");
-    if(data_file == NULL) {
-        printf("File not found...\n");
+// convert the request in line, the answer is written to response
+void answerRequest(char *line, char *response, const size_t response_size) {
+    batchJob job;
+    spectocolRequest request;
+    char error[BATCH_LINE_MAX];
+    if(!parseBatchJob(server.ctx, line, &job, &request, error, sizeof(error))) {
+        snprintf(response, response_size, "error: %s\n", error);
         return;
     }
 
-    char ch;
-    char int_c[255] = "";
-    char float_c[255] = "";
-
-    int int_count = 0;
-    int float_count = 0;
-    int slot_index = 0;
-
-    bool column_crossed = false;
-    while((ch = fgetc(data_file)) != EOF) {
-        if(ch == ',')
-            column_crossed = true;
-        else if(ch == '\n') {
-            column_crossed = false;
-
-            // get int value
-            int wl = atoi(int_c);
-
-            // get float value
-            double in = atof(float_c);
+    request.status = spectocolConvert(server.ctx, request.method, request.num_samples,
+                                      request.luminaire, request.reflectance, request.xyz, request.rgb);
+    if(request.status == SPECTOCOL_OK)
+        snprintf(response, response_size, "%.5f,%.5f,%.5f,%.5f,%.5f,%.5f\n", request.xyz[0], request.xyz[1],
+                 request.xyz[2], request.rgb[0], request.rgb[1], request.rgb[2]);
+    else
+        snprintf(response, response_size, "error: %s\n", spectocolStatusMessage(request.status));
+    clearBatchJob(&job, &request);
+}
 
-            // assign
-            addNodeToTable(table, wl, in);
-            slot_index++;
-            int_count = 0;
-            float_count = 0;
-        }
-        else if(isdigit(ch) && !column_crossed) {
-            int_c[int_count] = ch;
-            int_count++;
-        }
-        else if((isdigit(ch) || ch == '.') && column_crossed) {
-            float_c[float_count] = ch;
-            float_count++;
-        }
+// read one request line into line (SERVER_REQUEST_MAX + 2 bytes), false at the end of the stream.
+// A longer line is skipped up to its newline without being stored and sets too_long
+bool readRequest(FILE *in, char *line, bool *too_long) {
+    if(fgets(line, SERVER_REQUEST_MAX + 2, in) == NULL)
+        return false;
+    size_t length = strlen(line);
+    *too_long = length > SERVER_REQUEST_MAX && line[length - 1] != '\n';
+    if(*too_long) {
+        char rest[BATCH_LINE_MAX];
+        while(fgets(rest, sizeof(rest), in) != NULL && rest[strlen(rest) - 1] != '\n')
+            ;
     }
-    fclose(data_file);
+    return true;
 }
 
-// do the above for all provided functions
-void readAllFiles(void) {
-    // luminaire data
-    readFile("../data/luminaire data/cie_a.txt", cie_incandescent);
-    readFile("../data/luminaire data/cie_d65.txt", cie_daylight);
-    readFile("../data/luminaire data/f11.txt", f11);
+void *serveClient(void *arg) {
+    int fd = (int)(intptr_t)arg;
+    FILE *in = fdopen(fd, "r");
+    FILE *out = fdopen(dup(fd), "w");
 
-    // reflection data
-    readFile("../data/reflectance values/a1.txt", xrite_a1);
-    readFile("../data/reflectance values/e2.txt", xrite_e2);
-    readFile("../data/reflectance values/f4.txt", xrite_f4);
-    readFile("../data/reflectance values/g4.txt", xrite_g4);
-    readFile("../data/reflectance values/h4.txt", xrite_h4);
-    readFile("../data/reflectance values/j4.txt", xrite_j4);
+    char *line = (char *)malloc(SERVER_REQUEST_MAX + 2);
+    bool too_long;
+    char response[BATCH_LINE_MAX + 16];
 
-    // cie matching functions
-    readFile("../data/cie/cie_x.txt", cie_x);
-    readFile("../data/cie/cie_y.txt", cie_y);
-    readFile("../data/cie/cie_z.txt", cie_z);
+    while(in != NULL && out != NULL && readRequest(in, line, &too_long)) {
+        if(too_long) {
+            snprintf(response, sizeof(response), "error: request longer than %d bytes\n", SERVER_REQUEST_MAX);
+        }
+        else {
+            char *request = trimField(line);
+            if(request[0] == '\0' || request[0] == '#')
+                continue;
+            answerRequest(request, response, sizeof(response));
+        }
 
-    // interpolate
-    interpolateTableInt(cie_x);
-    interpolateTableInt(cie_y);
-    interpolateTableInt(cie_z);
+        if(fputs(response, out) == EOF || fflush(out) == EOF)
+            break;
+    }
+    free(line);
 
+    removeClient(fd);
+    if(out != NULL)
+        fclose(out);
+    if(in != NULL)
+        fclose(in);
+    else
+        close(fd);
+    return NULL;
 }
 
-void deleteAllTables(void) {
-    deleteTable(cie_incandescent);
-    deleteTable(cie_daylight);
-    deleteTable(f11);
-
-    deleteTable(cie_incandescent);
-    deleteTable(cie_incandescent);
-    deleteTable(cie_incandescent);
-    deleteTable(cie_incandescent);
-    deleteTable(cie_incandescent);
-    deleteTable(cie_incandescent);
-
-    deleteTable(cie_incandescent);
-    deleteTable(cie_incandescent);
-    deleteTable(cie_incandescent);
-}
-// ========================================================
-// the actual main part of this homework assignment
-// calculation and conversion from spectral information
-// to colour
-// ========================================================
-void setFunctionsFromInput(char* l_func_s, char* r_func_s) {
-
-    // set l function
-    if(strcmp(l_func_s,"ciea") == 0)
-        l_func = cie_incandescent;
-    else if(strcmp(l_func_s,"cied") == 0)
-        l_func = cie_daylight;
-    else if(strcmp(l_func_s,"f11") == 0)
-        l_func = f11;
-    else {
-        printf("Couldn't find l_function: Wrong arguments...\n");
+// serve requests on socket_path until SIGINT or SIGTERM
+void serveConversions(spectocolContext *ctx, char *socket_path) {
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if(strlen(socket_path) >= sizeof(address.sun_path)) {
+        printf("Socket path %s is too long.\n", socket_path);
         return;
     }
-
-    // set r function
-    if(strcmp(r_func_s,"a1") == 0)
-        r_func = xrite_a1;
-    else if(strcmp(r_func_s,"e2") == 0)
-        r_func = xrite_e2;
-    else if(strcmp(r_func_s,"f4") == 0)
-        r_func = xrite_f4;
-    else if(strcmp(r_func_s,"g4") == 0)
-        r_func = xrite_g4;
-    else if(strcmp(r_func_s,"h4") == 0)
-        r_func = xrite_h4;
-    else if(strcmp(r_func_s,"j4") == 0)
-        r_func = xrite_j4;
-    else {
-        printf("Couldn't find r_function: Wrong arguments...\n");
+    strcpy(address.sun_path, socket_path);
+
+    server.listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    unlink(socket_path);
+    if(server.listen_fd < 0
+       || bind(server.listen_fd, (struct sockaddr *)&address, sizeof(address)) != 0
+       || listen(server.listen_fd, SERVER_BACKLOG) != 0) {
+        printf("Could not listen on %s: %s\n", socket_path, strerror(errno));
+        if(server.listen_fd >= 0)
+            close(server.listen_fd);
         return;
     }
-}
-
-void setUpFunctions(char* l_func_s, char* r_func_s) {
-    setFunctionsFromInput(l_func_s, r_func_s);
-    interpolateTableInt(l_func);
-    interpolateTableInt(r_func);
-}
 
-void heroWavelengthSampling(int num_samples, linkedList* l_func, linkedList* r_func) {
+    server.ctx = ctx;
 
-    linkedList *l_heroBuckets = (struct linkedList *)calloc(num_samples, sizeof (struct linkedList));
-    linkedList *r_heroBuckets = (struct linkedList *)calloc(num_samples, sizeof (struct linkedList));
-    linkedList *cie_x_hero = (struct linkedList *)calloc(num_samples, sizeof (struct linkedList));
-    linkedList *cie_y_hero = (struct linkedList *)calloc(num_samples, sizeof (struct linkedList));
-    linkedList *cie_z_hero = (struct linkedList *)calloc(num_samples, sizeof (struct linkedList));
+    // no SA_RESTART, so accept returns once a stop signal arrives
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = stopServer;
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+    signal(SIGPIPE, SIG_IGN);
 
-    // close enough approximation
-    // I do not interpolate the function well enough. I only have maximum 400 points.
-    // I would have to re-write large parts of the application and I dont have the time right now (exam period)
-    if(num_samples > 400)
-        num_samples = 400;
+    printf("Serving conversions on %s\n", socket_path);
+    fflush(stdout);
 
-    srand(time(0));
-    int delta = (int)(VISIBLE_SPECTRUM_UPPER_BOUND - VISIBLE_SPECTRUM_LOWER_BOUND) / num_samples;
-    int heroWavelength = getRandomNumber();
-
-    addNodeToFixedTable(l_heroBuckets, 0, heroWavelength, lookupAtWl(l_func, heroWavelength));
-    addNodeToFixedTable(r_heroBuckets, 0, heroWavelength, lookupAtWl(r_func, heroWavelength));
-    addNodeToFixedTable(cie_x_hero, 0, heroWavelength, lookupAtWl(cie_x, heroWavelength));
-    addNodeToFixedTable(cie_y_hero, 0, heroWavelength, lookupAtWl(cie_y, heroWavelength));
-    addNodeToFixedTable(cie_z_hero, 0, heroWavelength, lookupAtWl(cie_z, heroWavelength));
-
-    for(int j = 1; j < num_samples; j++) {
-        // int wl = heroWavelength + (j * delta);
-
-        int wl = (heroWavelength - VISIBLE_SPECTRUM_LOWER_BOUND + j*400/num_samples)
-             % (VISIBLE_SPECTRUM_UPPER_BOUND - VISIBLE_SPECTRUM_LOWER_BOUND) + VISIBLE_SPECTRUM_LOWER_BOUND;
+    while(!server_stopping) {
+        int fd = accept(server.listen_fd, NULL, NULL);
+        if(fd < 0) {
+            if(errno != EINTR && errno != ECONNABORTED)
+                printf("accept failed: %s\n", strerror(errno));
+            continue;
+        }
 
-        addNodeToFixedTable(l_heroBuckets, j, wl, lookupAtWl(l_func, wl));
-        addNodeToFixedTable(r_heroBuckets, j, wl, lookupAtWl(r_func, wl));
-        addNodeToFixedTable(cie_x_hero, j, wl, lookupAtWl(cie_x, wl));
-        addNodeToFixedTable(cie_y_hero, j, wl, lookupAtWl(cie_y, wl));
-        addNodeToFixedTable(cie_z_hero, j, wl, lookupAtWl(cie_z, wl));
+        // clients start with the stop signals blocked, so they always interrupt the accept above
+        addClient(fd);
+        pthread_t thread;
+        sigset_t stop_signals, previous;
+        sigemptyset(&stop_signals);
+        sigaddset(&stop_signals, SIGINT);
+        sigaddset(&stop_signals, SIGTERM);
+        pthread_sigmask(SIG_BLOCK, &stop_signals, &previous);
+        int created = pthread_create(&thread, NULL, serveClient, (void *)(intptr_t)fd);
+        pthread_sigmask(SIG_SETMASK, &previous, NULL);
+        if(created != 0) {
+            removeClient(fd);
+            close(fd);
+            continue;
+        }
+        pthread_detach(thread);
     }
 
-    selectionSort(l_heroBuckets, num_samples);
-    selectionSort(r_heroBuckets, num_samples);
-    selectionSort(cie_x_hero, num_samples);
-    selectionSort(cie_y_hero, num_samples);
-    selectionSort(cie_z_hero, num_samples);
-
-    linkedList* res_spec = pointwiseMultipication(l_heroBuckets, r_heroBuckets, num_samples);
-
-    printFunctionToFile("../data/intermediate results/rnd_hero_l_func_res.txt", l_heroBuckets, num_samples);
-    printFunctionToFile("../data/intermediate results/rnd_hero_r_func_res.txt", r_heroBuckets, num_samples);
-    printFunctionToFile("../data/intermediate results/rnd_hero_res_spec.txt", res_spec, num_samples);
-
-    printFunctionToFile("../data/intermediate results/res_cie_x.txt", cie_x_hero, num_samples);
-    printFunctionToFile("../data/intermediate results/res__cie_y.txt", cie_y_hero, num_samples);
-    printFunctionToFile("../data/intermediate results/res_cie_z.txt", cie_z_hero, num_samples);
-
-    cie_x_hero = pointwiseMultipication(cie_x_hero, res_spec, num_samples);
-    cie_y_hero = pointwiseMultipication(cie_y_hero, res_spec, num_samples);
-    cie_z_hero = pointwiseMultipication(cie_z_hero, res_spec, num_samples);
-
-    double cie_x_value = integrate_nonuniform(cie_x_hero, num_samples);
-    double cie_y_value = integrate_nonuniform(cie_y_hero, num_samples);
-    double cie_z_value = integrate_nonuniform(cie_z_hero, num_samples);
-
-    float cie[3] = {cie_x_value, cie_y_value, cie_z_value};
-    float rgb[3];
-
-    convertToRgb(cie, rgb);
-
-    printLine();
-    printf("Result of hero WL sampling: R(%.5f) G(%.5f) B(%.5f)\n", rgb[0], rgb[1], rgb[2]);
-    printLine();
-
-    free(res_spec);
-    free(l_heroBuckets);
-    free(r_heroBuckets);
-    free(cie_x_hero);
-    free(cie_y_hero);
-    free(cie_z_hero);
+    close(server.listen_fd);
+    unlink(socket_path);
+
+    // wake up the clients and wait until they are gone, they use the tables
+    pthread_mutex_lock(&server.lock);
+    for(int i = 0; i < server.client_count; i++)
+        shutdown(server.clients[i], SHUT_RDWR);
+    while(server.client_count > 0)
+        pthread_cond_wait(&server.clients_done, &server.lock);
+    pthread_mutex_unlock(&server.lock);
+    free(server.clients);
+    server.clients = NULL;
 }
 
-void rndWavelengthSampling(int num_samples, char* l_func_s, char* r_func_s) {
-    printf("Random wavelength (incl. hero) sampling with %d samples,\n"
-           "luminare function %s,\n"
-           "and reflectance function %s...\n", num_samples, l_func_s, r_func_s);
-
-    setUpFunctions(l_func_s, r_func_s);
-
-    linkedList *l_rndBuckets = (struct linkedList *)calloc(num_samples, sizeof (struct linkedList));
-    linkedList *r_rndBuckets = (struct linkedList *)calloc(num_samples, sizeof (struct linkedList));
-    linkedList *cie_x_rnd = (struct linkedList *)calloc(num_samples, sizeof (struct linkedList));
-    linkedList *cie_y_rnd = (struct linkedList *)calloc(num_samples, sizeof (struct linkedList));
-    linkedList *cie_z_rnd = (struct linkedList *)calloc(num_samples, sizeof (struct linkedList));
-
-    srand(time(0));
-    for(int i = 0; i < num_samples; i++) {
-        int rndWl = getRandomNumber();
-        addNodeToFixedTable(l_rndBuckets, i, rndWl, lookupAtWl(l_func, rndWl));
-        addNodeToFixedTable(r_rndBuckets, i, rndWl, lookupAtWl(r_func, rndWl));
-        addNodeToFixedTable(cie_x_rnd, i, rndWl, lookupAtWl(cie_x, rndWl));
-        addNodeToFixedTable(cie_y_rnd, i, rndWl, lookupAtWl(cie_y, rndWl));
-        addNodeToFixedTable(cie_z_rnd, i, rndWl, lookupAtWl(cie_z, rndWl));
+// ========================================================
+// image mode - render a hyperspectral reflectance cube,
+// see spectocolRenderImage
+// ========================================================
+void renderImage(spectocolContext *ctx, char *header_filename, char *output_filename, char *l_func_s) {
+    const spectocolSpectrum *luminaire = spectocolFindSpectrum(ctx, l_func_s, SPECTOCOL_LUMINAIRE);
+    if(!luminaire) {
+        printf("Couldn't find l_function: Wrong arguments...\n");
+        return;
     }
 
-    selectionSort(l_rndBuckets, num_samples);
-    selectionSort(r_rndBuckets, num_samples);
-    selectionSort(cie_x_rnd, num_samples);
-    selectionSort(cie_y_rnd, num_samples);
-    selectionSort(cie_z_rnd, num_samples);
-
-    linkedList* res_spec = pointwiseMultipication(l_rndBuckets, r_rndBuckets, num_samples);
-
-    printFunctionToFile("../data/intermediate results/rnd_l_func_res.txt", l_rndBuckets, num_samples);
-    printFunctionToFile("../data/intermediate results/rnd_r_func_res.txt", r_rndBuckets, num_samples);
-    printFunctionToFile("../data/intermediate results/rnd_res_spec.txt", res_spec, num_samples);
-
-    cie_x_rnd = pointwiseMultipication(cie_x_rnd, res_spec, num_samples);
-    cie_y_rnd = pointwiseMultipication(cie_y_rnd, res_spec, num_samples);
-    cie_z_rnd = pointwiseMultipication(cie_z_rnd, res_spec, num_samples);
-
-    printFunctionToFile("../data/intermediate results/ciex_res.txt", cie_x_rnd, num_samples);
-    printFunctionToFile("../data/intermediate results/ciey_res.txt", cie_y_rnd, num_samples);
-    printFunctionToFile("../data/intermediate results/ciez_res.txt", cie_z_rnd, num_samples);
-
-    float cie_x_value = integrate_nonuniform(cie_x_rnd, num_samples);
-    float cie_y_value = integrate_nonuniform(cie_y_rnd, num_samples);
-    float cie_z_value = integrate_nonuniform(cie_z_rnd, num_samples);
-
-    float cie[3] = {cie_x_value, cie_y_value, cie_z_value};
-    float rgb[3];
-
-    convertToRgb(cie, rgb);
-
-    printLine();
-    printf("Result of random WL sampling: R(%.5f) G(%.5f) B(%.5f)\n", rgb[0], rgb[1], rgb[2]);
-    printLine();
-
-    free(res_spec);
-    free(l_rndBuckets);
-    free(r_rndBuckets);
-    free(cie_x_rnd);
-    free(cie_y_rnd);
-    free(cie_z_rnd);
-
-    heroWavelengthSampling(num_samples, l_func, r_func);
+    if(spectocolRenderImage(ctx, header_filename, output_filename, luminaire, num_threads))
+        printf("Rendered %s to %s.\n", header_filename, output_filename);
 }
 
-void fxdWavelengthSampling(int num_samples, char* l_func_s, char* r_func_s) {
-    printf("Fixed wavelength sampling with %d samples,\n"
-           "luminare function %s,\n"
-           "and reflectance function %s...\n", num_samples, l_func_s, r_func_s);
-
-    if(num_samples > 50) {
-        printf("Number of samples for fixed wavelength sampling is too high. Please choose a value smaller than 50.\n");
-        exit(0);
+// ========================================================
+// rgb upsampling - fit the coefficient table once,
+// then upsample colours from the saved table
+// ========================================================
+void compileUpsampling(spectocolContext *ctx, char *table_filename, char *l_func_s, int resolution) {
+    const spectocolSpectrum *luminaire = spectocolFindSpectrum(ctx, l_func_s, SPECTOCOL_LUMINAIRE);
+    if(!luminaire) {
+        printf("Couldn't find l_function: Wrong arguments...\n");
+        return;
     }
 
-    setUpFunctions(l_func_s, r_func_s);
-
-    int delta = (int)(VISIBLE_SPECTRUM_UPPER_BOUND - VISIBLE_SPECTRUM_LOWER_BOUND) / (num_samples - 1);
-
-    linkedList* l_func_fxd = (struct linkedList *)calloc(num_samples, sizeof (struct linkedList));
-    linkedList* r_func_fxd = (struct linkedList *)calloc(num_samples, sizeof (struct linkedList));
-    linkedList* cie_x_fxd = (struct linkedList *)calloc(num_samples, sizeof (struct linkedList));
-    linkedList* cie_y_fxd = (struct linkedList *)calloc(num_samples, sizeof (struct linkedList));
-    linkedList* cie_z_fxd = (struct linkedList *)calloc(num_samples, sizeof (struct linkedList));
-
-    for(int j = 0; j < num_samples; j++) {
-        int wl = VISIBLE_SPECTRUM_LOWER_BOUND + (j * delta);
-        addNodeToFixedTable(l_func_fxd, j, wl, lookupAtWl(l_func, wl));
-        addNodeToFixedTable(r_func_fxd, j, wl, lookupAtWl(r_func, wl));
-        addNodeToFixedTable(cie_x_fxd, j, wl, lookupAtWl(cie_x, wl));
-        addNodeToFixedTable(cie_y_fxd, j, wl, lookupAtWl(cie_y, wl));
-        addNodeToFixedTable(cie_z_fxd, j, wl, lookupAtWl(cie_z, wl));
+    spectocolUpsamplingTable *table = spectocolCreateUpsamplingTable(ctx, luminaire, resolution, num_threads);
+    if(!table) {
+        printf("Could not fit an upsampling table of resolution %d.\n", resolution);
+        return;
     }
+    if(spectocolSaveUpsamplingTable(table, table_filename))
+        printf("Wrote the upsampling table to %s.\n", table_filename);
+    else
+        printf("Could not write %s.\n", table_filename);
+    spectocolDeleteUpsamplingTable(table);
+}
 
-    linkedList* res_spec = pointwiseMultipication(l_func_fxd, r_func_fxd, num_samples);
-    printFunctionToFile("../data/intermediate results/fxd_l_func.txt", l_func_fxd, num_samples);
-    printFunctionToFile("../data/intermediate results/fxd_r_func.txt", r_func_fxd, num_samples);
-    printFunctionToFile("../data/intermediate results/fxd_res_spec.txt", res_spec, num_samples);
-
-    cie_x_fxd = pointwiseMultipication(cie_x_fxd, res_spec, num_samples);
-    cie_y_fxd = pointwiseMultipication(cie_y_fxd, res_spec, num_samples);
-    cie_z_fxd = pointwiseMultipication(cie_z_fxd, res_spec, num_samples);
-
-    double cie_x_value = integrate_uniform(cie_x_fxd, num_samples, delta);
-    double cie_y_value = integrate_uniform(cie_y_fxd, num_samples, delta);
-    double cie_z_value = integrate_uniform(cie_z_fxd, num_samples, delta);
-
-    float cie[3] = {cie_x_value, cie_y_value, cie_z_value};
-    float rgb[3];
+// print the coefficients of an r,g,b colour and its reflectance every 10 nm
+void printUpsampled(char *table_filename, float rgb[3]) {
+    spectocolUpsamplingTable *table = spectocolLoadUpsamplingTable(table_filename);
+    if(!table) {
+        printf("Could not read the upsampling table %s.\n", table_filename);
+        return;
+    }
 
-    convertToRgb(cie, rgb);
+    float coefficients[3];
+    spectocolUpsample(table, rgb, 1, coefficients);
+    spectocolDeleteUpsamplingTable(table);
 
-    printLine();
-    printf("Result of fixed WL sampling: R(%.5f) G(%.5f) B(%.5f)\n", rgb[0], rgb[1], rgb[2]);
-    printLine();
+    double wavelength[41], reflectance[41];
+    for(int i = 0; i < 41; i++)
+        wavelength[i] = 380 + 10 * i;
+    spectocolEvaluateUpsampled(coefficients, wavelength, 41, reflectance);
 
-    free(res_spec);
-    free(l_func_fxd);
-    free(r_func_fxd);
-    free(cie_x_fxd);
-    free(cie_y_fxd);
-    free(cie_z_fxd);
+    printf("rgb %g,%g,%g: coefficients %g %g %g\n", rgb[0], rgb[1], rgb[2], coefficients[0], coefficients[1],
+           coefficients[2]);
+    for(int i = 0; i < 41; i++)
+        printf("%.0f nm: %f\n", wavelength[i], reflectance[i]);
 }
 
-void cmpWavelengthSampling(int num_samples, char* l_func_s, char* r_func_s) {
-    fxdWavelengthSampling(num_samples, l_func_s, r_func_s);
-    rndWavelengthSampling(num_samples, l_func_s, r_func_s);
-}
 // ========================================================
 // menu - parsing of user input commands
 // ========================================================
@@ -848,11 +707,109 @@ void printHelp(void) {
            "    --random n                 (for [r]andom wavelength sampling, where n is the number of samples)\n"
            "    --fixed n                  (for [f]ixed wavelength sampling, where n is the number of samples)\n"
            "    --compare n                (uses both random- and wavelength sampling and compares the results. n is the number of samples)\n"
-           "    -l [ciea/cied/f11]         (for [l]uminaire data, default = ciea)\n"
-           "    -r [a1/e2/f4/g4/h4/j4]     (for [r]eflectance data, default = a1)\n"
+           "    --batch manifest.csv       (converts every luminaire,reflectance,method,samples line of the manifest,\n"
+           "                                method is one of fixed/random/hero, results are written to stdout as csv)\n"
+           "    --threads n                (number of worker threads for --batch, default = one per core)\n"
+           "    --all-pairs n              (fixed sampling with n samples of every reflectance of --reflectances under\n"
+           "                                every luminaire of --luminaires as one matrix product, csv to stdout,\n"
+           "                                n is at most 50 or the number of grid wavelengths)\n"
+           "    --luminaires ciea,cied,... (luminaires of --all-pairs)\n"
+           "    --reflectances a1,e2,...   (reflectances of --all-pairs)\n"
+           "    --db file                  (loads all spectra from a compiled spectral database instead of the text files)\n"
+           "    --compile-db file          (compiles the text files in the data folder into a spectral database)\n"
+           "    --data-dir dir             (searches dir for spectra, can be given several times, default = ../data)\n"
+           "    --list                     (lists all available spectra)\n"
+           "    --serve socket             (keeps the tables loaded and answers luminaire,reflectance,method,samples\n"
+           "                                lines on the unix socket with x,y,z,r,g,b lines)\n"
+           "    --image cube.hdr           (renders an ENVI hyperspectral reflectance cube under the luminaire -l)\n"
+           "    --output image.ppm         (output of --image, .ppm for 8 bit sRGB or .pfm for linear floats, default = image.ppm)\n"
+           "    --target-error e           (random sampling until the standard error of X, Y and Z is below e,\n"
+           "                                --random n sets the sample budget)\n"
+           "    --target-delta-e d         (random sampling until the estimated CIELAB delta E is below d)\n"
+           "    --qmc sobol/halton/r2      (draws the wavelengths of random, hero and streaming sampling from a\n"
+           "                                randomised low discrepancy sequence instead of pseudo random numbers)\n"
+           "    --grid lower,upper,step    (wavelengths in nm all spectra are resampled to, default = 380,780,1)\n"
+           "    --seed n                   (seed of the random numbers, with the same seed every run gives the same\n"
+           "                                results on any number of threads, default = the time)\n"
+           "    --importance luminaire/y/xyz/ly\n"
+           "                               (random, hero and streaming sampling draw wavelengths in proportion to the\n"
+           "                                luminaire, cie_y, cie_x+cie_y+cie_z or luminaire*cie_y, default = uniform)\n"
+           "    --alloc-stats              (prints the arena memory statistics to stderr at exit)\n"
+           "    --results text/binary/off  (format the sampled functions of a single conversion are written in,\n"
+           "                                default = text)\n"
+           "    --results-dir dir          (directory of those files, default = ../data/intermediate results)\n"
+           "    --profile                  (prints the time, allocations and lookups of every stage as json\n"
+           "                                to stderr at exit)\n"
+           "    --profile-trace trace.json (the same, and writes every stage call as a chrome trace event)\n"
+           "    --compile-upsampling file  (fits the rgb to spectrum coefficient table under the luminaire -l, default = cied,\n"
+           "                                and saves it to file, uses --threads)\n"
+           "    --upsampling-resolution n  (points of the table along each axis, default = 64)\n"
+           "    --upsample r,g,b           (prints the reflectance of a linear sRGB colour, with --upsampling file)\n"
+           "    --upsampling file          (the table of --upsample)\n"
+           "    -l [ciea/cied/f11/...]     (for [l]uminaire data, default = ciea)\n"
+           "    -r [a1/e2/f4/g4/h4/j4/...] (for [r]eflectance data, default = a1)\n"
            );
 }
 
+// name of a low discrepancy sequence given with --qmc
+bool parseSequence(const char *name, spectocolSequence *sequence) {
+    if(strcmp(name, "sobol") == 0)
+        *sequence = SPECTOCOL_SEQUENCE_SOBOL;
+    else if(strcmp(name, "halton") == 0)
+        *sequence = SPECTOCOL_SEQUENCE_HALTON;
+    else if(strcmp(name, "r2") == 0)
+        *sequence = SPECTOCOL_SEQUENCE_R2;
+    else
+        return false;
+    return true;
+}
+
+// spectral grid given with --grid as lower,upper,step
+bool parseGrid(const char *text, spectocolGrid *grid) {
+    char rest;
+    return sscanf(text, "%lf,%lf,%lf%c", &grid->lower, &grid->upper, &grid->step, &rest) == 3;
+}
+
+// pdf of importance sampling given with --importance
+bool parseImportance(const char *name, spectocolImportance *importance) {
+    if(strcmp(name, "uniform") == 0)
+        *importance = SPECTOCOL_IMPORTANCE_UNIFORM;
+    else if(strcmp(name, "luminaire") == 0)
+        *importance = SPECTOCOL_IMPORTANCE_LUMINAIRE;
+    else if(strcmp(name, "y") == 0)
+        *importance = SPECTOCOL_IMPORTANCE_Y;
+    else if(strcmp(name, "xyz") == 0)
+        *importance = SPECTOCOL_IMPORTANCE_XYZ;
+    else if(strcmp(name, "ly") == 0)
+        *importance = SPECTOCOL_IMPORTANCE_LUMINAIRE_Y;
+    else
+        return false;
+    return true;
+}
+
+// linear sRGB colour given with --upsample as r,g,b
+bool parseRgb(const char *text, float rgb[3]) {
+    char rest;
+    return sscanf(text, "%f,%f,%f%c", &rgb[0], &rgb[1], &rgb[2], &rest) == 3;
+}
+
+// format of the sampled functions given with --results
+bool parseResultFormat(const char *name, bool *enabled, spectocolResultFormat *format) {
+    *enabled = strcmp(name, "off") != 0;
+    if(!*enabled)
+        return true;
+    if(strcmp(name, "text") == 0)
+        *format = SPECTOCOL_RESULTS_TEXT;
+    else if(strcmp(name, "binary") == 0)
+        *format = SPECTOCOL_RESULTS_BINARY;
+    else
+        return false;
+    return true;
+}
+
+// if this flag is set, the arena statistics are printed at exit
+bool print_allocation_stats = false;
+
 // menu parsing
 void startMenu(int argc, char **argv) {
     //printHeader();
@@ -865,7 +822,37 @@ void startMenu(int argc, char **argv) {
 
     char refl_function_name[30] = "";
     char lum_function_name[30] = "";
-    int n;
+    char *manifest_filename = NULL;
+    char *database_filename = NULL;
+    char *compile_db_filename = NULL;
+    char *image_filename = NULL;
+    char *output_filename = "image.ppm";
+    char *socket_path = NULL;
+    char *data_directories[DATA_DIRECTORIES_MAX];
+    int directory_count = 0;
+    bool list_flag = false;
+    bool profile_flag = false;
+    bool results_flag = true;
+    const char *results_directory = "../data/intermediate results";
+    spectocolResultFormat results_format = SPECTOCOL_RESULTS_TEXT;
+    char *profile_trace_filename = NULL;
+    spectocolSequence sequence = SPECTOCOL_SEQUENCE_RANDOM;
+    spectocolImportance importance = SPECTOCOL_IMPORTANCE_UNIFORM;
+    spectocolGrid grid;
+    spectocolGrid *grid_option = NULL;
+    bool seed_flag = false;
+    uint64_t seed = 0;
+    char *luminaire_list = NULL;
+    char *reflectance_list = NULL;
+    int all_pairs_samples = 0;
+    char *compile_upsampling_filename = NULL;
+    char *upsampling_filename = NULL;
+    int upsampling_resolution = SPECTOCOL_UPSAMPLING_RESOLUTION_DEFAULT;
+    bool upsample_flag = false;
+    float upsample_rgb[3];
+    double target_error = 0;
+    double target_delta_e = 0;
+    int n = 0;
     int c;
 
     // start menu
@@ -882,6 +869,33 @@ void startMenu(int argc, char **argv) {
 
                         {"liminaire",  required_argument, 0, 'l'},
                         {"reflectance",  required_argument, 0, 'r'},
+                        {"batch",  required_argument, 0, 'b'},
+                        {"threads",  required_argument, 0, 't'},
+                        {"db",  required_argument, 0, 'd'},
+                        {"compile-db",  required_argument, 0, 'c'},
+                        {"data-dir",  required_argument, 0, 'D'},
+                        {"list",  no_argument, 0, 'L'},
+                        {"alloc-stats",  no_argument, 0, 'A'},
+                        {"profile",  no_argument, 0, 'P'},
+                        {"profile-trace",  required_argument, 0, 'T'},
+                        {"results",  required_argument, 0, 'R'},
+                        {"results-dir",  required_argument, 0, 'O'},
+                        {"image",  required_argument, 0, 'i'},
+                        {"serve",  required_argument, 0, 's'},
+                        {"output",  required_argument, 0, 'o'},
+                        {"target-error",  required_argument, 0, 'e'},
+                        {"target-delta-e",  required_argument, 0, 'E'},
+                        {"qmc",  required_argument, 0, 'q'},
+                        {"importance",  required_argument, 0, 'p'},
+                        {"grid",  required_argument, 0, 'g'},
+                        {"seed",  required_argument, 0, 'S'},
+                        {"all-pairs",  required_argument, 0, 'y'},
+                        {"luminaires",  required_argument, 0, 'M'},
+                        {"reflectances",  required_argument, 0, 'N'},
+                        {"compile-upsampling",  required_argument, 0, 'u'},
+                        {"upsampling-resolution",  required_argument, 0, 'n'},
+                        {"upsampling",  required_argument, 0, 'U'},
+                        {"upsample",  required_argument, 0, 'a'},
                         {0, 0, 0, 0}
                 };
         int option_index = 0;
@@ -918,6 +932,147 @@ void startMenu(int argc, char **argv) {
                 strcpy(refl_function_name, optarg);
                 break;
 
+            case 'b':
+                manifest_filename = optarg;
+                break;
+
+            case 't':
+                num_threads = atoi(optarg);
+                break;
+
+            case 'd':
+                database_filename = optarg;
+                break;
+
+            case 'c':
+                compile_db_filename = optarg;
+                break;
+
+            case 'D':
+                if(directory_count < DATA_DIRECTORIES_MAX)
+                    data_directories[directory_count++] = optarg;
+                else
+                    printf("Too many data directories, %s is ignored.\n", optarg);
+                break;
+
+            case 'L':
+                list_flag = true;
+                break;
+
+            case 'A':
+                print_allocation_stats = true;
+                break;
+
+            case 'P':
+                profile_flag = true;
+                break;
+
+            case 'T':
+                profile_flag = true;
+                profile_trace_filename = optarg;
+                break;
+
+            case 'R':
+                if(!parseResultFormat(optarg, &results_flag, &results_format)) {
+                    printf("Unknown result format %s, use text, binary or off.\n", optarg);
+                    return;
+                }
+                break;
+
+            case 'O':
+                results_directory = optarg;
+                break;
+
+            case 'i':
+                image_filename = optarg;
+                break;
+
+            case 'o':
+                output_filename = optarg;
+                break;
+
+            case 's':
+                socket_path = optarg;
+                break;
+
+            case 'e':
+                target_error = atof(optarg);
+                break;
+
+            case 'E':
+                target_delta_e = atof(optarg);
+                break;
+
+            case 'q':
+                if(!parseSequence(optarg, &sequence)) {
+                    printf("Unknown sequence %s, use sobol, halton or r2.\n", optarg);
+                    return;
+                }
+                break;
+
+            case 'g':
+                if(!parseGrid(optarg, &grid)) {
+                    printf("Expected the grid as lower,upper,step in nm, e.g. 360,830,5.\n");
+                    return;
+                }
+                grid_option = &grid;
+                break;
+
+            case 'S': {
+                char *end;
+                seed = strtoull(optarg, &end, 0);
+                if(end == optarg || *end != '\0') {
+                    printf("Expected the seed as a non-negative integer.\n");
+                    return;
+                }
+                seed_flag = true;
+                break;
+            }
+
+            case 'y':
+                all_pairs_samples = atoi(optarg);
+                break;
+
+            case 'M':
+                luminaire_list = optarg;
+                break;
+
+            case 'N':
+                reflectance_list = optarg;
+                break;
+
+            case 'u':
+                compile_upsampling_filename = optarg;
+                break;
+
+            case 'n':
+                upsampling_resolution = atoi(optarg);
+                if(upsampling_resolution < 2 || upsampling_resolution > SPECTOCOL_UPSAMPLING_RESOLUTION_MAX) {
+                    printf("Expected the upsampling resolution between 2 and %d.\n",
+                           SPECTOCOL_UPSAMPLING_RESOLUTION_MAX);
+                    return;
+                }
+                break;
+
+            case 'U':
+                upsampling_filename = optarg;
+                break;
+
+            case 'a':
+                if(!parseRgb(optarg, upsample_rgb)) {
+                    printf("Expected the colour as r,g,b, e.g. 0.2,0.4,0.8.\n");
+                    return;
+                }
+                upsample_flag = true;
+                break;
+
+            case 'p':
+                if(!parseImportance(optarg, &importance)) {
+                    printf("Unknown pdf %s, use uniform, luminaire, y, xyz or ly.\n", optarg);
+                    return;
+                }
+                break;
+
             case '?':
                 /* getopt_long already printed an error message. */
                 printf("Something went wrong ... Here's some help:\n");
@@ -937,17 +1092,64 @@ void startMenu(int argc, char **argv) {
         putchar ('\n');
     }
 
+    // before anything is read, so the file reads are profiled as well
+    if(help_flag == 0 && profile_flag)
+        spectocolEnableProfiling(profile_trace_filename);
+
+    if(help_flag == 0 && compile_db_filename != NULL) {
+        spectocolCompileDatabaseOnGrid(grid_option, compile_db_filename, data_directories, directory_count);
+        return;
+    }
+
+    // the table holds everything upsampling needs, no spectra are loaded
+    if(help_flag == 0 && upsample_flag) {
+        if(upsampling_filename != NULL)
+            printUpsampled(upsampling_filename, upsample_rgb);
+        else
+            printf("--upsample needs the table given with --upsampling.\n");
+        return;
+    }
+
     if(help_flag == 0) {
-        if (rnd_flag == 0 && cmp_flag == 0) {
-            printLine();
-            fxdWavelengthSampling(n, lum_function_name, refl_function_name);
-        } else if (rnd_flag == 1 && cmp_flag == 0) {
-            printLine();
-            rndWavelengthSampling(n, lum_function_name, refl_function_name);
-        } else if (cmp_flag == 1) {
+        spectocolContext *ctx = spectocolCreateContextOnGrid(grid_option, database_filename, data_directories,
+                                                             directory_count);
+        if(!ctx)
+            return;
+        spectocolSetSequence(ctx, sequence);
+        spectocolSetImportance(ctx, importance);
+        if(seed_flag)
+            spectocolSetSeed(ctx, seed);
+
+        if (list_flag) {
+            spectocolPrintSpectra(ctx);
+        } else if (compile_upsampling_filename != NULL) {
+            compileUpsampling(ctx, compile_upsampling_filename, lum_function_name[0] ? lum_function_name : "cied",
+                              upsampling_resolution);
+        } else if (socket_path != NULL) {
+            serveConversions(ctx, socket_path);
+        } else if (image_filename != NULL) {
+            renderImage(ctx, image_filename, output_filename, lum_function_name);
+        } else if (all_pairs_samples > 0) {
+            if(luminaire_list != NULL && reflectance_list != NULL)
+                allPairsWavelengthSampling(ctx, all_pairs_samples, luminaire_list, reflectance_list);
+            else
+                printf("--all-pairs needs the spectra given with --luminaires and --reflectances.\n");
+        } else if (manifest_filename != NULL) {
+            batchWavelengthSampling(ctx, manifest_filename);
+        } else {
+            // single conversions write their samples for plotting
+            spectocolSetResultSink(ctx, results_flag ? results_directory : NULL, results_format);
             printLine();
-            cmpWavelengthSampling(n, lum_function_name, refl_function_name);
+            if (target_error > 0 || target_delta_e > 0)
+                targetWavelengthSampling(ctx, target_error, target_delta_e, n, lum_function_name, refl_function_name);
+            else if (rnd_flag == 0 && cmp_flag == 0)
+                fxdWavelengthSampling(ctx, n, lum_function_name, refl_function_name);
+            else if (rnd_flag == 1 && cmp_flag == 0)
+                rndWavelengthSampling(ctx, n, lum_function_name, refl_function_name);
+            else
+                cmpWavelengthSampling(ctx, n, lum_function_name, refl_function_name);
         }
+        spectocolDeleteContext(ctx);
     } else {
         printHelp();
         printLine();
@@ -958,15 +1160,14 @@ void startMenu(int argc, char **argv) {
 // main function
 // ========================================================
 int main(int argc, char **argv) {
-    //prepossessing stuff
-    initDataContainers();
-    readAllFiles();
-
-    // start menu
+    // start menu, loads the tables as well
     startMenu(argc, argv);
 
     //clean up
-    deleteAllTables();
+    if(print_allocation_stats)
+        spectocolPrintAllocationStats();
+    spectocolWriteProfile();
+    spectocolReleaseMemory();
 
     return 0;
 }
@@ -0,0 +1,4422 @@
+// ======================================================================== //
+// SPECTRAL TO COLOUR CONVERTER - library                                   //
+// Calculates XYZ and RGB values from spectral information.                 //
+//                                                                          //
+// Author: Sebastian Schimper                                               //
+// ======================================================================== //
+#include "spectocol.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <ctype.h>
+#include <assert.h>
+#include <math.h>
+#include <time.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <dirent.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+// ========================================================
+// Definition of the sizes of the tables used later
+// Stuct for representing wavelength and intensity values
+// ========================================================
+#define VISIBLE_SPECTRUM_LOWER_BOUND 380    // default grid of a context
+#define VISIBLE_SPECTRUM_UPPER_BOUND 780
+#define VISIBLE_SPECTRUM_STEP 1.0
+#define GRID_COUNT_MAX (1 << 20)
+#define NOT_IN_TABLE -10000000000
+#define EMEMENT_COUNT_MAX 30
+#define PI 3.14159265
+#define CACHE_LINE_SIZE 64
+
+// dense spectrum: one contiguous, cache-aligned array of intensities
+// sample i lies at wavelength start + i * step, unless the spectrum is
+// non-uniform (e.g. randomly sampled), then the wavelengths are stored explicitly
+typedef struct spectrum {
+    float start;
+    float step;
+    int count;
+    float *wavelength;   // NULL for uniform spectra
+    double *intensity;
+    bool borrowed;       // intensity points into memory the spectrum does not own
+    bool registered;     // owned by the registry of a context, lives as long as the context
+} spectrum;
+
+// the wavelengths every spectrum of a context is stored at: lower, lower + step, ..., upper
+typedef struct spectralGrid {
+    double lower;
+    double upper;
+    double step;
+    int count;
+} spectralGrid;
+
+// ========================================================
+// GLOBAL VARIABLES
+// - transformation matrix and containers for data
+// ========================================================
+
+// used for conversion from CIE XYZ -> sRGB
+static const float transformation_matrix[3][3] = {
+        {3.2410, -1.5374, -0.4986},
+        {-0.9692, 1.8760, 0.0416},
+        {0.0556, -0.2050, 1.0570}
+};
+
+// ========================================================
+// memory: aligned allocation and arenas
+// an arena hands out memory from large blocks by bumping a
+// pointer. Everything allocated during a run is released at
+// once by rewinding the arena to where the run started, the
+// blocks are kept and reused by the next run.
+// Every thread has its own arena, when a thread ends its
+// arena is handed on to the next new thread.
+// ========================================================
+#define ARENA_BLOCK_SIZE (256 * 1024)
+#define ARENA_HEADER_SIZE CACHE_LINE_SIZE
+
+// set by spectocolEnableProfiling, then the heap allocations of every thread are counted
+static bool profiling = false;
+static __thread unsigned long thread_heap_allocations = 0;
+static __thread size_t thread_heap_bytes = 0;
+
+// allocate a cache-aligned block of memory
+static void *allocAligned(size_t size) {
+    void *ptr = NULL;
+    if(posix_memalign(&ptr, CACHE_LINE_SIZE, size) != 0) {
+        printf("Error: Could not allocate %zu bytes.\n", size);
+        exit(1);
+    }
+    if(__builtin_expect(profiling, 0)) {
+        thread_heap_allocations++;
+        thread_heap_bytes += size;
+    }
+    return ptr;
+}
+
+typedef struct arenaBlock {
+    struct arenaBlock *next;
+    size_t size;    // usable bytes behind the header
+    size_t used;
+} arenaBlock;
+
+typedef struct arena {
+    arenaBlock *first;
+    arenaBlock *current;
+    size_t bytes_in_use;
+    size_t peak_bytes;
+    size_t reserved_bytes;
+    size_t total_bytes;
+    unsigned long allocations;
+    bool in_use;            // owned by a running thread
+    struct arena *next;     // list of all arenas
+} arena;
+
+// position of an arena, to rewind to later
+typedef struct arenaMark {
+    arenaBlock *block;
+    size_t used;
+    size_t bytes_in_use;
+} arenaMark;
+
+static arena *all_arenas = NULL;
+static pthread_mutex_t all_arenas_lock = PTHREAD_MUTEX_INITIALIZER;
+static __thread arena *thread_arena = NULL;
+static pthread_key_t thread_arena_key;
+static pthread_once_t thread_arena_once = PTHREAD_ONCE_INIT;
+
+static char *getBlockData(arenaBlock *block) {
+    return (char *)block + ARENA_HEADER_SIZE;
+}
+
+static arenaBlock *createArenaBlock(arena *a, size_t size) {
+    if(size < ARENA_BLOCK_SIZE)
+        size = ARENA_BLOCK_SIZE;
+    arenaBlock *block = (arenaBlock *)allocAligned(ARENA_HEADER_SIZE + size);
+    block->next = NULL;
+    block->size = size;
+    block->used = 0;
+    a->reserved_bytes += size;
+    return block;
+}
+
+// the caller must hold all_arenas_lock
+static struct arena *createArena(void) {
+    arena *a = (struct arena *)calloc(1, sizeof(struct arena));
+    a->first = a->current = createArenaBlock(a, ARENA_BLOCK_SIZE);
+    a->next = all_arenas;
+    all_arenas = a;
+    return a;
+}
+
+// cache-aligned memory from the arena, valid until the arena is rewound past it
+static void *arenaAlloc(arena *a, size_t size) {
+    size = (size + CACHE_LINE_SIZE - 1) / CACHE_LINE_SIZE * CACHE_LINE_SIZE;
+
+    arenaBlock *block = a->current;
+    if(block->used + size > block->size) {
+        // move on to the next kept block, or put a new one in front of it
+        if(block->next != NULL && block->next->size >= size) {
+            block = block->next;
+        }
+        else {
+            arenaBlock *newBlock = createArenaBlock(a, size);
+            newBlock->next = block->next;
+            block->next = newBlock;
+            block = newBlock;
+        }
+        block->used = 0;
+        a->current = block;
+    }
+
+    void *ptr = getBlockData(block) + block->used;
+    block->used += size;
+
+    a->bytes_in_use += size;
+    a->total_bytes += size;
+    a->allocations++;
+    if(a->bytes_in_use > a->peak_bytes)
+        a->peak_bytes = a->bytes_in_use;
+    return ptr;
+}
+
+static arenaMark arenaSave(const arena *a) {
+    arenaMark mark = {a->current, a->current->used, a->bytes_in_use};
+    return mark;
+}
+
+// release everything allocated since the mark in O(1)
+static void arenaRestore(arena *a, const arenaMark mark) {
+    a->current = mark.block;
+    a->current->used = mark.used;
+    a->bytes_in_use = mark.bytes_in_use;
+}
+
+// called when a thread ends, its arena is free for the next thread
+static void releaseThreadArena(void *arg) {
+    arena *a = (struct arena *)arg;
+    pthread_mutex_lock(&all_arenas_lock);
+    a->current = a->first;
+    a->current->used = 0;
+    a->bytes_in_use = 0;
+    a->in_use = false;
+    pthread_mutex_unlock(&all_arenas_lock);
+}
+
+static void createThreadArenaKey(void) {
+    pthread_key_create(&thread_arena_key, releaseThreadArena);
+}
+
+// arena of the calling thread, taken over from an ended thread or created on first use
+static struct arena *getThreadArena(void) {
+    if(thread_arena != NULL)
+        return thread_arena;
+
+    pthread_once(&thread_arena_once, createThreadArenaKey);
+    pthread_mutex_lock(&all_arenas_lock);
+    arena *a = all_arenas;
+    while(a != NULL && a->in_use)
+        a = a->next;
+    if(a == NULL)
+        a = createArena();
+    a->in_use = true;
+    pthread_mutex_unlock(&all_arenas_lock);
+
+    pthread_setspecific(thread_arena_key, a);
+    thread_arena = a;
+    return a;
+}
+
+void spectocolPrintAllocationStats(void) {
+    int count = 0;
+    size_t reserved = 0, peak = 0, total = 0;
+    unsigned long allocations = 0;
+
+    pthread_mutex_lock(&all_arenas_lock);
+    for(arena *a = all_arenas; a != NULL; a = a->next) {
+        count++;
+        reserved += a->reserved_bytes;
+        peak += a->peak_bytes;
+        total += a->total_bytes;
+        allocations += a->allocations;
+    }
+    pthread_mutex_unlock(&all_arenas_lock);
+    fprintf(stderr, "Arenas: %d, allocations: %lu, bytes allocated: %zu, peak bytes in use: %zu, bytes reserved: %zu\n",
+            count, allocations, total, peak, reserved);
+}
+
+// free the arenas of the ended threads and of the calling thread. The arenas of the
+// threads still running stay in the list, they are released when those threads end
+void spectocolReleaseMemory(void) {
+    pthread_mutex_lock(&all_arenas_lock);
+    if(thread_arena != NULL) {
+        pthread_setspecific(thread_arena_key, NULL);
+        thread_arena->in_use = false;
+        thread_arena = NULL;
+    }
+
+    arena **link = &all_arenas;
+    while(*link != NULL) {
+        arena *a = *link;
+        if(a->in_use) {
+            link = &a->next;
+            continue;
+        }
+        *link = a->next;
+        arenaBlock *block = a->first;
+        while(block != NULL) {
+            arenaBlock *next_block = block->next;
+            free(block);
+            block = next_block;
+        }
+        free(a);
+    }
+    pthread_mutex_unlock(&all_arenas_lock);
+}
+
+// ========================================================
+// profiling - every instrumented stage counts its calls,
+// time (monotonic, inclusive of nested stages), heap and
+// arena allocations and the samples or lookups it handled.
+// The counters are process-wide, like the arenas. If a
+// trace file was given, every call is also recorded as a
+// chrome trace event. With profiling off a stage costs one
+// predictable branch
+// ========================================================
+#define PROFILE_TRACE_EVENTS_MAX (1 << 20)
+
+typedef enum profileStage {
+    PROFILE_READ_FILE,
+    PROFILE_INTERPOLATE,
+    PROFILE_SORT,
+    PROFILE_WRITE_FILE,
+    PROFILE_LOAD_DATABASE,
+    PROFILE_WEIGHTED_CMF,
+    PROFILE_FIXED,
+    PROFILE_RANDOM,
+    PROFILE_HERO,
+    PROFILE_IMPORTANCE,
+    PROFILE_STREAM,
+    PROFILE_IMAGE_TILE,
+    PROFILE_ALL_PAIRS,
+    PROFILE_STAGES
+} profileStage;
+
+static const char *profile_stage_names[PROFILE_STAGES] = {
+        "readFile", "interpolateTableInt", "countingSort", "writeResultRecord", "loadDatabase",
+        "createWeightedCmf", "fxdSpectrumToXyz", "rndSpectrumToXyz", "heroSpectrumToXyz",
+        "importanceSpectrumToXyz", "streamSpectrumToXyz", "renderImageTile", "convertPairBlock"
+};
+
+typedef struct profileCounters {
+    unsigned long calls;
+    uint64_t total_ns;
+    uint64_t max_ns;
+    unsigned long heap_allocations;
+    size_t heap_bytes;
+    unsigned long arena_allocations;
+    size_t arena_bytes;
+    unsigned long lookups;
+} profileCounters;
+
+typedef struct profileEvent {
+    profileStage stage;
+    int thread;
+    uint64_t start_ns;
+    uint64_t duration_ns;
+} profileEvent;
+
+typedef struct profileScope {
+    bool active;
+    profileStage stage;
+    uint64_t start_ns;
+    unsigned long heap_allocations;
+    size_t heap_bytes;
+    unsigned long arena_allocations;
+    size_t arena_bytes;
+} profileScope;
+
+static profileCounters profile_counters[PROFILE_STAGES];
+static pthread_mutex_t profile_lock = PTHREAD_MUTEX_INITIALIZER;
+static uint64_t profile_start_ns;
+static char *profile_trace_filename = NULL;
+static profileEvent *profile_events = NULL;
+static int profile_event_count = 0;
+static int profile_thread_count = 0;
+static __thread int profile_thread = -1;
+
+static uint64_t getMonotonicNs(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000u + now.tv_nsec;
+}
+
+static profileScope profileBegin(const profileStage stage) {
+    profileScope scope;
+    scope.active = __builtin_expect(profiling, 0);
+    if(!scope.active)
+        return scope;
+
+    arena *a = getThreadArena();
+    scope.stage = stage;
+    scope.heap_allocations = thread_heap_allocations;
+    scope.heap_bytes = thread_heap_bytes;
+    scope.arena_allocations = a->allocations;
+    scope.arena_bytes = a->total_bytes;
+    scope.start_ns = getMonotonicNs();
+    return scope;
+}
+
+// lookups is the number of samples, wavelengths or values the stage handled
+static void profileEnd(const profileScope *scope, const long lookups) {
+    if(!scope->active)
+        return;
+
+    uint64_t duration = getMonotonicNs() - scope->start_ns;
+    arena *a = getThreadArena();
+
+    pthread_mutex_lock(&profile_lock);
+    profileCounters *counters = &profile_counters[scope->stage];
+    counters->calls++;
+    counters->total_ns += duration;
+    if(duration > counters->max_ns)
+        counters->max_ns = duration;
+    counters->heap_allocations += thread_heap_allocations - scope->heap_allocations;
+    counters->heap_bytes += thread_heap_bytes - scope->heap_bytes;
+    counters->arena_allocations += a->allocations - scope->arena_allocations;
+    counters->arena_bytes += a->total_bytes - scope->arena_bytes;
+    counters->lookups += lookups;
+
+    if(profile_events != NULL && profile_event_count < PROFILE_TRACE_EVENTS_MAX) {
+        if(profile_thread < 0)
+            profile_thread = profile_thread_count++;
+        profile_events[profile_event_count++] = (profileEvent){scope->stage, profile_thread,
+                                                               scope->start_ns - profile_start_ns, duration};
+    }
+    pthread_mutex_unlock(&profile_lock);
+}
+
+static void writeProfileTrace(void) {
+    FILE *trace = fopen(profile_trace_filename, "w");
+    if(trace == NULL) {
+        fprintf(stderr, "Trace file %s could not be created.\n", profile_trace_filename);
+        return;
+    }
+    fprintf(trace, "{\"traceEvents\":[\n");
+    for(int i = 0; i < profile_event_count; i++) {
+        const profileEvent *e = &profile_events[i];
+        fprintf(trace, "{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f}%s\n",
+                profile_stage_names[e->stage], e->thread, e->start_ns / 1e3, e->duration_ns / 1e3,
+                i + 1 < profile_event_count ? "," : "");
+    }
+    fprintf(trace, "],\"displayTimeUnit\":\"ms\"}\n");
+    fclose(trace);
+}
+
+void spectocolEnableProfiling(const char *trace_filename) {
+    pthread_mutex_lock(&profile_lock);
+    profile_start_ns = getMonotonicNs();
+    if(trace_filename != NULL && profile_events == NULL) {
+        profile_trace_filename = strdup(trace_filename);
+        profile_events = (profileEvent *)malloc(PROFILE_TRACE_EVENTS_MAX * sizeof(profileEvent));
+    }
+    profiling = true;
+    pthread_mutex_unlock(&profile_lock);
+}
+
+void spectocolWriteProfile(void) {
+    if(!profiling)
+        return;
+
+    pthread_mutex_lock(&profile_lock);
+    fprintf(stderr, "{\"wall_ms\":%.3f,\"stages\":[", (getMonotonicNs() - profile_start_ns) / 1e6);
+    bool first = true;
+    for(int i = 0; i < PROFILE_STAGES; i++) {
+        const profileCounters *c = &profile_counters[i];
+        if(c->calls == 0)
+            continue;
+        fprintf(stderr, "%s\n  {\"name\":\"%s\",\"calls\":%lu,\"total_ms\":%.3f,\"mean_us\":%.3f,\"max_us\":%.3f,"
+                        "\"heap_allocations\":%lu,\"heap_bytes\":%zu,\"arena_allocations\":%lu,\"arena_bytes\":%zu,"
+                        "\"lookups\":%lu}",
+                first ? "" : ",", profile_stage_names[i], c->calls, c->total_ns / 1e6, c->total_ns / 1e3 / c->calls,
+                c->max_ns / 1e3, c->heap_allocations, c->heap_bytes, c->arena_allocations, c->arena_bytes,
+                c->lookups);
+        first = false;
+    }
+    fprintf(stderr, "\n]}\n");
+
+    if(profile_events != NULL) {
+        if(profile_event_count == PROFILE_TRACE_EVENTS_MAX)
+            fprintf(stderr, "The trace holds the first %d events only.\n", PROFILE_TRACE_EVENTS_MAX);
+        writeProfileTrace();
+    }
+    pthread_mutex_unlock(&profile_lock);
+}
+
+// ========================================================
+// SPECTRUM DATA STRUCTURE stuff
+// ========================================================
+// create a uniform spectrum, every sample is marked as missing
+static struct spectrum *createSpectrum(const float start, const float step, const int count) {
+    struct spectrum *newSpectrum;
+    newSpectrum = (struct spectrum *)malloc(sizeof(struct spectrum));
+    newSpectrum->start = start;
+    newSpectrum->step = step;
+    newSpectrum->count = count;
+    newSpectrum->wavelength = NULL;
+    newSpectrum->intensity = (double *)allocAligned(count * sizeof(double));
+    newSpectrum->borrowed = false;
+    newSpectrum->registered = false;
+
+    for(int i = 0; i < count; i++)
+        newSpectrum->intensity[i] = NOT_IN_TABLE;
+
+    return newSpectrum;
+}
+
+// create a non-uniform spectrum with count samples at arbitrary wavelengths
+static struct spectrum *createSampledSpectrum(const int count) {
+    struct spectrum *newSpectrum = createSpectrum(0.0f, 0.0f, count);
+    newSpectrum->wavelength = (float *)allocAligned(count * sizeof(float));
+    return newSpectrum;
+}
+
+// create a uniform spectrum on top of existing intensities, e.g. a mapped file
+static struct spectrum *createMappedSpectrum(const float start, const float step, const int count, double *intensity) {
+    struct spectrum *newSpectrum;
+    newSpectrum = (struct spectrum *)malloc(sizeof(struct spectrum));
+    newSpectrum->start = start;
+    newSpectrum->step = step;
+    newSpectrum->count = count;
+    newSpectrum->wavelength = NULL;
+    newSpectrum->intensity = intensity;
+    newSpectrum->borrowed = true;
+    newSpectrum->registered = false;
+    return newSpectrum;
+}
+
+// create a non-uniform spectrum for a single run inside an arena
+// the samples are left uninitialised, the spectrum must not be passed to deleteSpectrum
+static struct spectrum *createArenaSpectrum(arena *a, const int count) {
+    struct spectrum *newSpectrum;
+    newSpectrum = (struct spectrum *)arenaAlloc(a, sizeof(struct spectrum));
+    newSpectrum->start = 0.0f;
+    newSpectrum->step = 0.0f;
+    newSpectrum->count = count;
+    newSpectrum->wavelength = (float *)arenaAlloc(a, count * sizeof(float));
+    newSpectrum->intensity = (double *)arenaAlloc(a, count * sizeof(double));
+    newSpectrum->borrowed = true;
+    newSpectrum->registered = false;
+    return newSpectrum;
+}
+
+// create a spectrum covering a grid
+static struct spectrum *createGridSpectrum(const spectralGrid *grid) {
+    return createSpectrum(grid->lower, grid->step, grid->count);
+}
+
+// the grid from lower to upper in steps, upper is moved down onto the grid.
+// False if the grid is empty or too fine
+static bool setUpGrid(spectralGrid *grid, const double lower, const double upper, const double step) {
+    if(!(step > 0) || !(upper > lower) || (upper - lower) / step >= GRID_COUNT_MAX)
+        return false;
+    grid->lower = lower;
+    grid->step = step;
+    grid->count = (int)floor((upper - lower) / step + 1e-6) + 1;
+    grid->upper = lower + (grid->count - 1) * step;
+    return true;
+}
+
+// true if a spectrum is stored on the wavelengths of a grid
+static bool isOnGrid(const struct spectrum *table, const spectralGrid *grid) {
+    return table->wavelength == NULL && table->count == grid->count
+           && fabs(table->start - grid->lower) < 1e-3 && fabs(table->step - grid->step) < 1e-6 * grid->step + 1e-9;
+}
+
+static void deleteSpectrum(struct spectrum *table) {
+    if(!table)
+        return;
+    free(table->wavelength);
+    if(!table->borrowed)
+        free(table->intensity);
+    free(table);
+}
+
+static float getWavelengthAtIndex(const struct spectrum *table, const int i) {
+    if(table->wavelength)
+        return table->wavelength[i];
+    return table->start + i * table->step;
+}
+
+static void addNodeToFixedTable(struct spectrum *table, const int index, const float wl, const double in) {
+    if(table->wavelength)
+        table->wavelength[index] = wl;
+    table->intensity[index] = in;
+}
+
+// linear interpolation between the samples of a uniform spectrum at an arbitrary wavelength inside its range
+static double interpolateAtWl(const struct spectrum *table, const double wl) {
+    double x = (wl - table->start) / table->step;
+    int i = (int)x;
+    assert(i >= 0 && i < table->count);
+    if(i >= table->count - 1)
+        return table->intensity[table->count - 1];
+    double t = x - i;
+    return table->intensity[i] + t * (table->intensity[i + 1] - table->intensity[i]);
+}
+
+static double lookupAtIndex(const struct spectrum *table, const int i) {
+    return table->intensity[i];
+}
+
+// ========================================================
+// interpolation stuff
+// ========================================================
+// http://paulbourke.net/miscellaneous/interpolation/
+static double cosineInterpolate(
+        double y1,double y2,
+        double mu)
+{
+    double mu2;
+
+    mu2 = (1-cos(mu*PI))/2;
+    return(y1*(1-mu2)+y2*mu2);
+}
+
+// fill the missing samples between two known ones, a missing sample at either end of the grid is 0
+static void interpolateTableInt(spectrum *table) {
+    int x1, x2, j;
+    const int last = table->count - 1;
+    profileScope scope = profileBegin(PROFILE_INTERPOLATE);
+
+    if(lookupAtIndex(table, 0) == NOT_IN_TABLE)
+        table->intensity[0] = 0.0;
+    if(lookupAtIndex(table, last) == NOT_IN_TABLE)
+        table->intensity[last] = 0.0;
+
+    for(int i = 1; i < last; i++) {
+        if(lookupAtIndex(table, i) == NOT_IN_TABLE) {
+            x1 = i - 1;
+            j = i + 1;
+
+            while(j < last && lookupAtIndex(table, j) == NOT_IN_TABLE) {
+                j++;
+            }
+            x2 = j;
+
+            float d = x2 - x1;
+            double y1 = lookupAtIndex(table, x1);
+            double y2 = lookupAtIndex(table, x2);
+
+            float p = 1.0;
+            for(int k = x1 + 1; k < x2; k++) {
+                table->intensity[k] = cosineInterpolate(y1, y2, (p/d));
+                p = p + 1.0;
+            }
+            i = j;
+        }
+    }
+    profileEnd(&scope, table->count);
+}
+
+// true if at least one sample of the grid is known
+static bool hasSamples(const spectrum *table) {
+    for(int i = 0; i < table->count; i++) {
+        if(lookupAtIndex(table, i) != NOT_IN_TABLE)
+            return true;
+    }
+    return false;
+}
+// ========================================================
+// integration
+// ========================================================
+static float integrate_uniform(const spectrum *table, const float delta) {
+
+    float result = 0;
+    for(int i = 0; i < table->count - 1; i++) {
+        float currentIn = table->intensity[i];
+        float nextIn = table->intensity[i+1];
+        result += ((currentIn + nextIn) / 2) * delta;
+    }
+    return result;
+}
+
+// ========================================================
+// fused integration of X, Y and Z
+// the trapezoid rule is written as a weighted sum, so the
+// three integrals become three dot products that are
+// computed in one streaming pass
+// ========================================================
+// trapezoid weights for samples that are delta apart
+static void trapezoidWeightsUniform(double *weights, const int count, const double delta) {
+    for(int i = 0; i < count; i++)
+        weights[i] = delta;
+    weights[0] = delta / 2;
+    weights[count - 1] = delta / 2;
+    if(count == 1)
+        weights[0] = 0.0;
+}
+
+// trapezoid weights for sorted samples at arbitrary wavelengths
+static void trapezoidWeightsNonuniform(double *weights, const float *wavelength, const int count) {
+    for(int i = 0; i < count; i++)
+        weights[i] = 0.0;
+    for(int i = 0; i < count - 1; i++) {
+        float width = wavelength[i+1] - wavelength[i];
+        weights[i] += (double)width / 2;
+        weights[i+1] += (double)width / 2;
+    }
+}
+
+// xyz = (s . x, s . y, s . z)
+typedef void (*xyzKernel)(const double *s,
+                          const double *x, const double *y, const double *z,
+                          int count, double xyz[3]);
+
+static void dotXyzScalar(const double *s,
+                         const double *x, const double *y, const double *z,
+                         int count, double xyz[3]) {
+    double sum_x = 0, sum_y = 0, sum_z = 0;
+    for(int i = 0; i < count; i++) {
+        sum_x += x[i] * s[i];
+        sum_y += y[i] * s[i];
+        sum_z += z[i] * s[i];
+    }
+    xyz[0] = sum_x;
+    xyz[1] = sum_y;
+    xyz[2] = sum_z;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+static __attribute__((target("avx2")))
+void dotXyzAvx2(const double *s,
+                const double *x, const double *y, const double *z,
+                int count, double xyz[3]) {
+    __m256d sum_x = _mm256_setzero_pd();
+    __m256d sum_y = _mm256_setzero_pd();
+    __m256d sum_z = _mm256_setzero_pd();
+
+    int i = 0;
+    for(; i + 4 <= count; i += 4) {
+        __m256d si = _mm256_loadu_pd(s + i);
+        sum_x = _mm256_add_pd(sum_x, _mm256_mul_pd(_mm256_loadu_pd(x + i), si));
+        sum_y = _mm256_add_pd(sum_y, _mm256_mul_pd(_mm256_loadu_pd(y + i), si));
+        sum_z = _mm256_add_pd(sum_z, _mm256_mul_pd(_mm256_loadu_pd(z + i), si));
+    }
+
+    double lanes[3][4];
+    _mm256_storeu_pd(lanes[0], sum_x);
+    _mm256_storeu_pd(lanes[1], sum_y);
+    _mm256_storeu_pd(lanes[2], sum_z);
+
+    dotXyzScalar(s + i, x + i, y + i, z + i, count - i, xyz);
+    for(int c = 0; c < 3; c++)
+        xyz[c] += (lanes[c][0] + lanes[c][1]) + (lanes[c][2] + lanes[c][3]);
+}
+
+static __attribute__((target("avx512f")))
+void dotXyzAvx512(const double *s,
+                  const double *x, const double *y, const double *z,
+                  int count, double xyz[3]) {
+    __m512d sum_x = _mm512_setzero_pd();
+    __m512d sum_y = _mm512_setzero_pd();
+    __m512d sum_z = _mm512_setzero_pd();
+
+    int i = 0;
+    for(; i + 8 <= count; i += 8) {
+        __m512d si = _mm512_loadu_pd(s + i);
+        sum_x = _mm512_add_pd(sum_x, _mm512_mul_pd(_mm512_loadu_pd(x + i), si));
+        sum_y = _mm512_add_pd(sum_y, _mm512_mul_pd(_mm512_loadu_pd(y + i), si));
+        sum_z = _mm512_add_pd(sum_z, _mm512_mul_pd(_mm512_loadu_pd(z + i), si));
+    }
+
+    dotXyzScalar(s + i, x + i, y + i, z + i, count - i, xyz);
+    xyz[0] += _mm512_reduce_add_pd(sum_x);
+    xyz[1] += _mm512_reduce_add_pd(sum_y);
+    xyz[2] += _mm512_reduce_add_pd(sum_z);
+}
+#endif
+
+static xyzKernel xyz_kernel = dotXyzScalar;
+static pthread_once_t xyz_kernel_once = PTHREAD_ONCE_INIT;
+
+// pick the widest kernel the cpu supports
+static void selectXyzKernel(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("avx512f"))
+        xyz_kernel = dotXyzAvx512;
+    else if(__builtin_cpu_supports("avx2"))
+        xyz_kernel = dotXyzAvx2;
+#endif
+}
+
+static void dotXyz(const double *s,
+                   const double *x, const double *y, const double *z,
+                   int count, double xyz[3]) {
+    pthread_once(&xyz_kernel_once, selectXyzKernel);
+    xyz_kernel(s, x, y, z, count, xyz);
+}
+
+// ========================================================
+// multiplication
+// ========================================================
+static void convertToRgb(float cie_vec[3], float res[3])
+{
+    int i, j;
+    for (i = 0; i < 3; i++)
+    {
+        res[i] = 0;
+        for (j = 0; j < 3; j++)
+        {
+            res[i] += transformation_matrix[i][j] * cie_vec[j];
+        }
+    }
+}
+// ========================================================
+// randomness - wavelengths are drawn from a sampler, either
+// pseudo random or one of the low discrepancy sequences.
+// The sequences are randomised (scrambled or shifted) per
+// sampler, so independent samplers give independent
+// estimates and their spread is an error estimate.
+// Pseudo random numbers come from philox 4x32-10, a
+// counter based generator: number i of a sampler is a
+// function of the seed, the stream, the substream and i
+// only, so a conversion gives the same result on any
+// thread and in any order
+// ========================================================
+#define INVERSE_GOLDEN_RATIO 0.6180339887498949
+#define PHILOX_M0 0xd2511f53u
+#define PHILOX_M1 0xcd9e8d57u
+#define PHILOX_W0 0x9e3779b9u
+#define PHILOX_W1 0xbb67ae85u
+#define PHILOX_RANDOMISATION_BLOCK 0xffffffffu  // block of the scramble and shift, never reached by samples
+
+typedef struct wavelengthSampler {
+    spectocolSequence sequence;
+    uint32_t key[2];        // the seed
+    uint32_t counter[4];    // block, substream and stream (two words)
+    uint32_t block[4];      // output of the current block, two samples
+    uint32_t index;         // next point of the sequence
+    uint32_t scramble;      // seed of the sobol scramble
+    double shift;           // random shift of halton and r2
+} wavelengthSampler;
+
+// ten rounds of philox 4x32 on counter with key, in place
+static void philox4x32(uint32_t counter[4], const uint32_t key[2]) {
+    uint32_t k0 = key[0];
+    uint32_t k1 = key[1];
+    for(int round = 0; round < 10; round++) {
+        uint64_t p0 = (uint64_t)PHILOX_M0 * counter[0];
+        uint64_t p1 = (uint64_t)PHILOX_M1 * counter[2];
+        uint32_t c0 = (uint32_t)(p1 >> 32) ^ counter[1] ^ k0;
+        uint32_t c2 = (uint32_t)(p0 >> 32) ^ counter[3] ^ k1;
+        counter[0] = c0;
+        counter[1] = (uint32_t)p1;
+        counter[2] = c2;
+        counter[3] = (uint32_t)p0;
+        k0 += PHILOX_W0;
+        k1 += PHILOX_W1;
+    }
+}
+
+static void getRandomBlock(const wavelengthSampler *sampler, const uint32_t block, uint32_t out[4]) {
+    out[0] = block;
+    out[1] = sampler->counter[1];
+    out[2] = sampler->counter[2];
+    out[3] = sampler->counter[3];
+    philox4x32(out, sampler->key);
+}
+
+// double in [0, 1) with 53 random bits
+static double toUnitDouble(const uint32_t high, const uint32_t low) {
+    return (((uint64_t)(high >> 5) << 26) | (low >> 6)) * 0x1p-53;
+}
+
+// sample i of the pseudo random stream, a block holds two of them
+static double getUniformRandom(wavelengthSampler *sampler, const uint32_t i) {
+    if((i & 1) == 0)
+        getRandomBlock(sampler, i >> 1, sampler->block);
+    return (i & 1) ? toUnitDouble(sampler->block[2], sampler->block[3])
+                   : toUnitDouble(sampler->block[0], sampler->block[1]);
+}
+
+static uint32_t reverseBits(uint32_t x) {
+    x = ((x >> 1) & 0x55555555u) | ((x & 0x55555555u) << 1);
+    x = ((x >> 2) & 0x33333333u) | ((x & 0x33333333u) << 2);
+    x = ((x >> 4) & 0x0f0f0f0fu) | ((x & 0x0f0f0f0fu) << 4);
+    x = ((x >> 8) & 0x00ff00ffu) | ((x & 0x00ff00ffu) << 8);
+    return (x >> 16) | (x << 16);
+}
+
+// owen scrambling of a bit reversed value, hash by Laine and Karras
+static uint32_t scrambleReversed(uint32_t x, const uint32_t seed) {
+    x += seed;
+    x ^= x * 0x6c50b47cu;
+    x ^= x * 0xb82f1e52u;
+    x ^= x * 0xc7afe638u;
+    x ^= x * 0x8d22f6e6u;
+    return x;
+}
+
+// first dimension of the sobol sequence (van der Corput in base 2), owen scrambled
+static double getSobolSample(const uint32_t index, const uint32_t scramble) {
+    return reverseBits(scrambleReversed(index, scramble)) * 0x1p-32;
+}
+
+static double getRadicalInverse3(uint32_t index) {
+    double result = 0;
+    double digit_value = 1.0 / 3;
+    while(index > 0) {
+        result += (index % 3) * digit_value;
+        index /= 3;
+        digit_value /= 3;
+    }
+    return result;
+}
+
+static double wrapToUnit(const double u) {
+    return u >= 1 ? u - 1 : u;
+}
+
+// a sampler of stream (e.g. the index of a request) under seed. Substreams are
+// independent samplers within one conversion
+static void initSampler(wavelengthSampler *sampler, const spectocolSequence sequence, const uint64_t seed,
+                        const uint64_t stream, const uint32_t substream) {
+    sampler->sequence = sequence;
+    sampler->key[0] = (uint32_t)seed;
+    sampler->key[1] = (uint32_t)(seed >> 32);
+    sampler->counter[0] = 0;
+    sampler->counter[1] = substream;
+    sampler->counter[2] = (uint32_t)stream;
+    sampler->counter[3] = (uint32_t)(stream >> 32);
+    sampler->index = 0;
+
+    uint32_t randomisation[4];
+    getRandomBlock(sampler, PHILOX_RANDOMISATION_BLOCK, randomisation);
+    sampler->scramble = randomisation[0];
+    sampler->shift = toUnitDouble(randomisation[2], randomisation[3]);
+}
+
+// next sample in [0, 1)
+static double getNextSample(wavelengthSampler *sampler) {
+    uint32_t i = sampler->index++;
+    switch(sampler->sequence) {
+        case SPECTOCOL_SEQUENCE_SOBOL:
+            return getSobolSample(i, sampler->scramble);
+        case SPECTOCOL_SEQUENCE_HALTON:
+            return wrapToUnit(getRadicalInverse3(i) + sampler->shift);
+        case SPECTOCOL_SEQUENCE_R2:
+            return wrapToUnit(fmod(sampler->shift + i * INVERSE_GOLDEN_RATIO, 1.0));
+        default:
+            return getUniformRandom(sampler, i);
+    }
+}
+
+// index into a grid of count wavelengths, every wavelength is equally likely
+static int getNextGridIndex(wavelengthSampler *sampler, const int count) {
+    int i = (int)(getNextSample(sampler) * count);
+    return i < count ? i : count - 1;
+}
+
+// ========================================================
+// sorting
+// ========================================================
+// sort indices into a grid of count wavelengths by counting how often each one occurs,
+// O(n + count). histogram needs count entries
+static void countingSort(int *indices, const int n, const int count, int *histogram) {
+    profileScope scope = profileBegin(PROFILE_SORT);
+    memset(histogram, 0, count * sizeof(int));
+    for(int i = 0; i < n; i++)
+        histogram[indices[i]]++;
+
+    int k = 0;
+    for(int j = 0; j < count; j++) {
+        for(int c = 0; c < histogram[j]; c++)
+            indices[k++] = j;
+    }
+    profileEnd(&scope, n);
+}
+
+// ========================================================
+// point-wise multiplication
+// ========================================================
+static struct spectrum *pointwiseMultipication(const spectrum *a, const spectrum *b) {
+
+    assert(a->count == b->count);
+
+    spectrum *res;
+    if(a->wavelength) {
+        res = createSampledSpectrum(a->count);
+        memcpy(res->wavelength, a->wavelength, a->count * sizeof(float));
+    }
+    else {
+        res = createSpectrum(a->start, a->step, a->count);
+    }
+
+    for(int i = 0; i < a->count; i++) {
+        assert(getWavelengthAtIndex(a, i) == getWavelengthAtIndex(b, i));
+        res->intensity[i] = a->intensity[i] * b->intensity[i];
+    }
+    return res;
+}
+
+// ========================================================
+// parsing of spectral data files
+// the whole file is read into memory and scanned line by
+// line. Every line holds one wavelength-intensity-pair in
+// one of the formats
+//      {380, 0.0014},      (brace format of the data folder)
+//      380,0.0014          (csv, ';' works as well)
+//      380<tab>0.0014      (tsv or any white space)
+// Empty lines and lines starting with '#' are skipped, as
+// is a header line in front of the first pair.
+// ========================================================
+#define MAX_FAST_DIGITS 19
+
+// exactly representable powers of ten
+static const double powers_of_ten[] = {
+        1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10,
+        1e11, 1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+// read a whole file into a NUL-terminated buffer, NULL if it can't be read
+static char *readWholeFile(const char *filename, size_t *size) {
+    FILE *data_file = fopen(filename, "rb");
+    if(data_file == NULL)
+        return NULL;
+
+    char *buffer = NULL;
+    if(fseek(data_file, 0, SEEK_END) == 0) {
+        long length = ftell(data_file);
+        if(length >= 0 && fseek(data_file, 0, SEEK_SET) == 0) {
+            buffer = (char *)malloc(length + 1);
+            *size = fread(buffer, 1, length, data_file);
+            buffer[*size] = '\0';
+        }
+    }
+    fclose(data_file);
+    return buffer;
+}
+
+// scan a decimal number [+-]digits[.digits][(e|E)[+-]digits] starting at *cursor
+// on success *cursor points behind the number
+static bool scanNumber(const char **cursor, const char *end, double *value) {
+    const char *p = *cursor;
+    bool negative = false;
+    if(p < end && (*p == '+' || *p == '-')) {
+        negative = *p == '-';
+        p++;
+    }
+
+    uint64_t mantissa = 0;
+    int digits = 0;
+    int exponent = 0;
+    bool any_digit = false;
+
+    while(p < end && isdigit((unsigned char)*p)) {
+        if(digits < MAX_FAST_DIGITS) {
+            mantissa = mantissa * 10 + (*p - '0');
+            if(mantissa != 0)
+                digits++;
+        }
+        else {
+            exponent++;
+            digits++;
+        }
+        any_digit = true;
+        p++;
+    }
+    if(p < end && *p == '.') {
+        p++;
+        while(p < end && isdigit((unsigned char)*p)) {
+            if(digits < MAX_FAST_DIGITS) {
+                mantissa = mantissa * 10 + (*p - '0');
+                exponent--;
+                if(mantissa != 0)
+                    digits++;
+            }
+            else {
+                digits++;
+            }
+            any_digit = true;
+            p++;
+        }
+    }
+    if(!any_digit)
+        return false;
+
+    if(p < end && (*p == 'e' || *p == 'E')) {
+        const char *q = p + 1;
+        bool negative_exponent = false;
+        if(q < end && (*q == '+' || *q == '-')) {
+            negative_exponent = *q == '-';
+            q++;
+        }
+        if(q < end && isdigit((unsigned char)*q)) {
+            int e = 0;
+            while(q < end && isdigit((unsigned char)*q)) {
+                if(e < 100000)
+                    e = e * 10 + (*q - '0');
+                q++;
+            }
+            exponent += negative_exponent ? -e : e;
+            p = q;
+        }
+    }
+
+    // fast path: the mantissa and the power of ten are both exact doubles,
+    // so one multiplication or division rounds correctly
+    if(digits <= 15 && exponent >= -22 && exponent <= 22) {
+        double result = (double)mantissa;
+        result = exponent < 0 ? result / powers_of_ten[-exponent] : result * powers_of_ten[exponent];
+        *value = negative ? -result : result;
+    }
+    else {
+        char number[128];
+        size_t length = p - *cursor;
+        if(length >= sizeof(number))
+            length = sizeof(number) - 1;
+        memcpy(number, *cursor, length);
+        number[length] = '\0';
+        *value = strtod(number, NULL);
+    }
+
+    *cursor = p;
+    return true;
+}
+
+static const char *skipBlanks(const char *p, const char *end) {
+    while(p < end && (*p == ' ' || *p == '\t' || *p == '\r'))
+        p++;
+    return p;
+}
+
+// strip leading and trailing white space in place
+static char *trimWhitespace(char *s) {
+    while(isspace((unsigned char)*s))
+        s++;
+    char *end = s + strlen(s);
+    while(end > s && isspace((unsigned char)end[-1]))
+        end--;
+    *end = '\0';
+    return s;
+}
+
+// parse one line, returns 1 for a pair, 0 for a line without data and -1 for a malformed line
+static int parseSpectralLine(const char *p, const char *end, double *wl, double *in) {
+    p = skipBlanks(p, end);
+    if(p == end || *p == '#')
+        return 0;
+
+    bool brace = false;
+    if(*p == '{') {
+        brace = true;
+        p = skipBlanks(p + 1, end);
+    }
+
+    if(!scanNumber(&p, end, wl))
+        return -1;
+
+    // separator: ',' or ';' with optional blanks, or blanks only
+    const char *separator_start = p;
+    p = skipBlanks(p, end);
+    if(p < end && (*p == ',' || *p == ';'))
+        p = skipBlanks(p + 1, end);
+    else if(p == separator_start)
+        return -1;
+
+    if(!scanNumber(&p, end, in))
+        return -1;
+
+    p = skipBlanks(p, end);
+    if(brace) {
+        if(p == end || *p != '}')
+            return -1;
+        p = skipBlanks(p + 1, end);
+    }
+    if(p < end && (*p == ',' || *p == ';'))
+        p = skipBlanks(p + 1, end);
+
+    return p == end ? 1 : -1;
+}
+
+// store a sample at its nearest grid point, unless a closer sample is already stored there
+static void storeSample(struct spectrum *table, float *distance, const double wl, const double in) {
+    double position = (wl - table->start) / table->step;
+    long slot = lround(position);
+    if(slot >= 0 && slot < table->count) {
+        float d = fabs(position - slot) * table->step;
+        if(d < distance[slot]) {
+            distance[slot] = d;
+            table->intensity[slot] = in;
+        }
+    }
+}
+
+// store count wavelength-intensity-pairs that are already in memory
+static void storeSamples(struct spectrum *table, const double *wavelength, const double *intensity, const int count) {
+    float *distance = (float *)malloc(table->count * sizeof(float));
+    for(int i = 0; i < table->count; i++)
+        distance[i] = table->step;
+    for(int i = 0; i < count; i++)
+        storeSample(table, distance, wavelength[i], intensity[i]);
+    free(distance);
+}
+
+// read filenames
+// samples are stored at the nearest grid point of the table, samples outside of the
+// table are skipped. Returns false if the file can't be read or has malformed lines.
+static bool readFile(char* filename, struct spectrum* table) {
+
+    profileScope scope = profileBegin(PROFILE_READ_FILE);
+    size_t size;
+    char *buffer = readWholeFile(filename, &size);
+    if(buffer == NULL) {
+        printf("File %s not found...\n", filename);
+        profileEnd(&scope, 0);
+        return false;
+    }
+
+    // distance of the stored sample to its grid point, the closest sample wins
+    float *distance = (float *)malloc(table->count * sizeof(float));
+    for(int i = 0; i < table->count; i++)
+        distance[i] = table->step;
+
+    const char *end = buffer + size;
+    const char *line = buffer;
+    int line_number = 0;
+    int pairs = 0;
+    int errors = 0;
+
+    while(line < end) {
+        const char *line_end = memchr(line, '\n', end - line);
+        if(line_end == NULL)
+            line_end = end;
+        line_number++;
+
+        double wl, in;
+        int status = parseSpectralLine(line, line_end, &wl, &in);
+
+        if(status == 1) {
+            storeSample(table, distance, wl, in);
+            pairs++;
+        }
+        else if(status == -1) {
+            const char *first = skipBlanks(line, line_end);
+            // a header in front of the data, e.g. "wavelength,intensity"
+            if(pairs == 0 && errors == 0 && first < line_end && (isalpha((unsigned char)*first) || *first == '"')) {
+                line = line_end + 1;
+                continue;
+            }
+            printf("%s:%d: expected a wavelength-intensity-pair: %.*s\n",
+                   filename, line_number, (int)(line_end - line), line);
+            errors++;
+        }
+        line = line_end + 1;
+    }
+
+    free(distance);
+    free(buffer);
+    profileEnd(&scope, pairs);
+    return errors == 0;
+}
+
+
+// ========================================================
+// spectrum registry
+// maps names to spectra through a hash index. The data
+// directories are only scanned for file names, a spectrum
+// is read and interpolated the first time it is asked for
+// and kept for the rest of the process.
+// A data directory holds the subfolders "luminaire data",
+// "reflectance values" and "cie", the name of a spectrum
+// is its file name without the extension.
+// ========================================================
+#define REGISTRY_INITIAL_BUCKETS 64
+#define DEFAULT_DATA_DIRECTORY "../data"
+#define DATA_DIRECTORIES_MAX 16
+
+// a spectrum compiled into the library from the data folder by spectocol_embed: the samples of
+// its file and, for contexts on the grid it was generated for, the interpolated table
+typedef struct builtinSpectrum {
+    const char *name;
+    spectocolKind kind;
+    int sample_count;
+    const double *wavelength;
+    const double *intensity;
+    const double *table;    // on the builtin grid, cache-aligned
+} builtinSpectrum;
+
+#ifdef SPECTOCOL_BUILTIN_SPECTRA
+#include "spectocol_builtin.inc"
+#else
+static const builtinSpectrum builtin_spectra[] = {{NULL, SPECTOCOL_CMF, 0, NULL, NULL, NULL}};
+#define BUILTIN_SPECTRUM_COUNT 0
+#define BUILTIN_GRID_LOWER VISIBLE_SPECTRUM_LOWER_BOUND
+#define BUILTIN_GRID_STEP VISIBLE_SPECTRUM_STEP
+#define BUILTIN_GRID_COUNT 0
+#endif
+
+typedef struct registryEntry {
+    char *name;
+    char *path;         // file the spectrum is read from, NULL if it is in memory already
+    const builtinSpectrum *builtin;     // or the built-in spectrum it is interpolated from
+    spectocolKind kind;
+    spectrum *table;    // NULL until first use
+    struct registryEntry *alias_of;
+    struct registryEntry *next;
+} registryEntry;
+
+typedef struct spectrumRegistry {
+    registryEntry **buckets;
+    int bucket_count;
+    int count;
+    spectralGrid grid;  // every spectrum is loaded onto it
+    pthread_mutex_t lock;
+} spectrumRegistry;
+
+typedef struct dataFolder {
+    const char *folder;
+    spectocolKind kind;
+} dataFolder;
+
+static const dataFolder data_folders[] = {
+        {"luminaire data", SPECTOCOL_LUMINAIRE},
+        {"reflectance values", SPECTOCOL_REFLECTANCE},
+        {"cie", SPECTOCOL_CMF}
+};
+
+// short names the command line has always accepted
+static const char *builtin_aliases[][2] = {
+        {"ciea", "cie_a"},
+        {"cied", "cie_d65"}
+};
+
+// FNV-1a
+static unsigned int hashName(const char *name) {
+    unsigned int hash = 2166136261u;
+    while(*name) {
+        hash ^= (unsigned char)*name++;
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static char *copyString(const char *s) {
+    size_t length = strlen(s) + 1;
+    char *copy = (char *)malloc(length);
+    memcpy(copy, s, length);
+    return copy;
+}
+
+static char *joinPath(const char *directory, const char *name) {
+    size_t length = strlen(directory) + strlen(name) + 2;
+    char *path = (char *)malloc(length);
+    snprintf(path, length, "%s/%s", directory, name);
+    return path;
+}
+
+static registryEntry *findEntry(spectrumRegistry *registry, const char *name) {
+    if(registry->bucket_count == 0)
+        return NULL;
+    registryEntry *entry = registry->buckets[hashName(name) & (registry->bucket_count - 1)];
+    while(entry != NULL && strcmp(entry->name, name) != 0)
+        entry = entry->next;
+    return entry;
+}
+
+static void growRegistry(spectrumRegistry *registry) {
+    int bucket_count = registry->bucket_count ? registry->bucket_count * 2 : REGISTRY_INITIAL_BUCKETS;
+    registryEntry **buckets = (registryEntry **)calloc(bucket_count, sizeof(registryEntry *));
+
+    for(int i = 0; i < registry->bucket_count; i++) {
+        registryEntry *entry = registry->buckets[i];
+        while(entry != NULL) {
+            registryEntry *next = entry->next;
+            unsigned int slot = hashName(entry->name) & (bucket_count - 1);
+            entry->next = buckets[slot];
+            buckets[slot] = entry;
+            entry = next;
+        }
+    }
+    free(registry->buckets);
+    registry->buckets = buckets;
+    registry->bucket_count = bucket_count;
+}
+
+// add a spectrum to the registry, the first registration of a name wins
+static registryEntry *registerSpectrum(spectrumRegistry *registry, const char *name, const char *path, const spectocolKind kind, spectrum *table) {
+    if(findEntry(registry, name) != NULL)
+        return NULL;
+    if(registry->count >= registry->bucket_count * 3 / 4)
+        growRegistry(registry);
+
+    registryEntry *entry = (registryEntry *)calloc(1, sizeof(registryEntry));
+    entry->name = copyString(name);
+    entry->path = path ? copyString(path) : NULL;
+    entry->kind = kind;
+    entry->table = table;
+    if(table != NULL)
+        table->registered = true;
+
+    unsigned int slot = hashName(name) & (registry->bucket_count - 1);
+    entry->next = registry->buckets[slot];
+    registry->buckets[slot] = entry;
+    registry->count++;
+    return entry;
+}
+
+static void registerAlias(spectrumRegistry *registry, const char *alias, const char *name) {
+    registryEntry *target = findEntry(registry, name);
+    if(target == NULL)
+        return;
+    registryEntry *entry = registerSpectrum(registry, alias, NULL, target->kind, NULL);
+    if(entry != NULL)
+        entry->alias_of = target;
+}
+
+// register every spectrum file below a data directory, returns the number of new spectra
+static int scanDataDirectory(spectrumRegistry *registry, const char *directory) {
+    int found = 0;
+    for(size_t f = 0; f < sizeof(data_folders) / sizeof(data_folders[0]); f++) {
+        char *folder = joinPath(directory, data_folders[f].folder);
+        DIR *dir = opendir(folder);
+        if(dir == NULL) {
+            free(folder);
+            continue;
+        }
+
+        struct dirent *file;
+        while((file = readdir(dir)) != NULL) {
+            char *extension = strrchr(file->d_name, '.');
+            if(extension == NULL || extension == file->d_name
+               || (strcmp(extension, ".txt") != 0 && strcmp(extension, ".csv") != 0 && strcmp(extension, ".tsv") != 0))
+                continue;
+
+            char *name = copyString(file->d_name);
+            name[extension - file->d_name] = '\0';
+            char *path = joinPath(folder, file->d_name);
+            if(registerSpectrum(registry, name, path, data_folders[f].kind, NULL) != NULL)
+                found++;
+            free(path);
+            free(name);
+        }
+        closedir(dir);
+        free(folder);
+    }
+    return found;
+}
+
+// read the file or built-in samples behind an entry and interpolate them onto the grid of the registry
+static bool loadEntry(const spectrumRegistry *registry, registryEntry *entry) {
+    spectrum *table = createGridSpectrum(&registry->grid);
+    if(entry->builtin != NULL)
+        storeSamples(table, entry->builtin->wavelength, entry->builtin->intensity, entry->builtin->sample_count);
+    else if(!readFile(entry->path, table) && !hasSamples(table)) {
+        deleteSpectrum(table);
+        return false;
+    }
+
+    if(!hasSamples(table)) {
+        printf("Spectrum %s has no sample between %gnm and %gnm.\n", entry->name,
+               registry->grid.lower, registry->grid.upper);
+        deleteSpectrum(table);
+        return false;
+    }
+
+    interpolateTableInt(table);
+    table->registered = true;
+    entry->table = table;
+    return true;
+}
+
+// look up a spectrum by name and load it on first use, NULL if unknown or of another kind
+static struct spectrum *getSpectrum(spectrumRegistry *registry, const char *name, const spectocolKind kind) {
+    pthread_mutex_lock(&registry->lock);
+    registryEntry *entry = findEntry(registry, name);
+    if(entry != NULL && entry->alias_of != NULL)
+        entry = entry->alias_of;
+
+    spectrum *table = NULL;
+    if(entry != NULL && entry->kind == kind) {
+        if(entry->table == NULL && (entry->path != NULL || entry->builtin != NULL))
+            loadEntry(registry, entry);
+        table = entry->table;
+    }
+    pthread_mutex_unlock(&registry->lock);
+    return table;
+}
+
+static int compareEntryNames(const void *a, const void *b) {
+    return strcmp((*(registryEntry * const *)a)->name, (*(registryEntry * const *)b)->name);
+}
+
+static void printAvailableSpectra(spectrumRegistry *registry) {
+    registryEntry **entries = (registryEntry **)malloc((registry->count + 1) * sizeof(registryEntry *));
+
+    for(size_t f = 0; f < sizeof(data_folders) / sizeof(data_folders[0]); f++) {
+        int count = 0;
+        for(int i = 0; i < registry->bucket_count; i++) {
+            for(registryEntry *entry = registry->buckets[i]; entry != NULL; entry = entry->next) {
+                if(entry->kind == data_folders[f].kind)
+                    entries[count++] = entry;
+            }
+        }
+        qsort(entries, count, sizeof(registryEntry *), compareEntryNames);
+
+        printf("%s:\n", data_folders[f].folder);
+        for(int i = 0; i < count; i++) {
+            if(entries[i]->alias_of != NULL)
+                printf("    %s (= %s)\n", entries[i]->name, entries[i]->alias_of->name);
+            else
+                printf("    %s\n", entries[i]->name);
+        }
+    }
+    free(entries);
+}
+
+static void deleteRegistry(spectrumRegistry *registry) {
+    for(int i = 0; i < registry->bucket_count; i++) {
+        registryEntry *entry = registry->buckets[i];
+        while(entry != NULL) {
+            registryEntry *next = entry->next;
+            deleteSpectrum(entry->table);
+            free(entry->name);
+            free(entry->path);
+            free(entry);
+            entry = next;
+        }
+    }
+    free(registry->buckets);
+    registry->buckets = NULL;
+    registry->bucket_count = 0;
+    registry->count = 0;
+}
+
+// ========================================================
+// result sink - the sampled functions of a conversion are
+// copied into a record and queued for a writer thread,
+// which writes every record to its own file in the results
+// directory, as text or as a binary dump. A conversion
+// only waits for the writer if the queue is full
+// ========================================================
+#define DEFAULT_RESULTS_DIRECTORY "../data/intermediate results"
+#define RESULT_NAME_MAX 32
+#define RESULT_QUEUE_BYTES_MAX (64 << 20)
+#define RESULT_WRITE_BUFFER_SIZE (1 << 16)
+#define RESULT_BINARY_MAGIC "SPCR"
+
+// one spectrum on its way to the disk, the values follow the record in the same allocation
+typedef struct resultRecord {
+    struct resultRecord *next;
+    size_t size;
+    char name[RESULT_NAME_MAX];
+    int count;
+    float start;
+    float step;
+    float *wavelength;      // NULL for uniform spectra
+    double *intensity;
+} resultRecord;
+
+typedef struct resultSink {
+    char *directory;
+    spectocolResultFormat format;
+    pthread_t writer;
+
+    pthread_mutex_t lock;
+    pthread_cond_t queued;      // a record was queued or the sink is closed
+    pthread_cond_t written;     // a record left the queue
+    resultRecord *head;
+    resultRecord *tail;
+    size_t queued_bytes;
+    bool closed;
+} resultSink;
+
+static void writeResultRecord(const resultSink *sink, const resultRecord *record) {
+    profileScope scope = profileBegin(PROFILE_WRITE_FILE);
+    const bool binary = sink->format == SPECTOCOL_RESULTS_BINARY;
+    char name[RESULT_NAME_MAX + 4];
+    snprintf(name, sizeof(name), "%s.%s", record->name, binary ? "bin" : "txt");
+    char *filename = joinPath(sink->directory, name);
+
+    FILE *data_file = fopen(filename, binary ? "wb" : "w");
+    if(data_file == NULL) {
+        printf("Error: The result file %s couldn't be created.\n", filename);
+        free(filename);
+        profileEnd(&scope, 0);
+        return;
+    }
+    setvbuf(data_file, NULL, _IOFBF, RESULT_WRITE_BUFFER_SIZE);
+
+    if(binary) {
+        uint32_t header[2] = {(uint32_t)record->count, record->wavelength != NULL};
+        fwrite(RESULT_BINARY_MAGIC, 1, 4, data_file);
+        fwrite(header, sizeof(uint32_t), 2, data_file);
+        fwrite(&record->start, sizeof(float), 1, data_file);
+        fwrite(&record->step, sizeof(float), 1, data_file);
+        if(record->wavelength)
+            fwrite(record->wavelength, sizeof(float), record->count, data_file);
+        fwrite(record->intensity, sizeof(double), record->count, data_file);
+    }
+    else if(record->wavelength == NULL) {
+        for(int i = 0; i < record->count; i++) {
+            if(record->intensity[i] != NOT_IN_TABLE)
+                fprintf(data_file, "%3i %11f\n", (int)(record->start + i * record->step), record->intensity[i]);
+        }
+    }
+    else {
+        for(int i = 0; i < record->count; i++)
+            fprintf(data_file, "%f %.6f\n", record->wavelength[i], record->intensity[i]);
+    }
+
+    if(fclose(data_file) != 0)
+        printf("Error: The result file %s couldn't be written.\n", filename);
+    free(filename);
+    profileEnd(&scope, record->count);
+}
+
+// writes the queued records until the sink is closed and the queue is empty
+static void *resultWriterLoop(void *argument) {
+    resultSink *sink = (resultSink *)argument;
+    pthread_mutex_lock(&sink->lock);
+    while(true) {
+        while(sink->head == NULL && !sink->closed)
+            pthread_cond_wait(&sink->queued, &sink->lock);
+        resultRecord *record = sink->head;
+        if(record == NULL)
+            break;
+        sink->head = record->next;
+        if(sink->head == NULL)
+            sink->tail = NULL;
+        pthread_mutex_unlock(&sink->lock);
+
+        writeResultRecord(sink, record);
+
+        pthread_mutex_lock(&sink->lock);
+        sink->queued_bytes -= record->size;
+        free(record);
+        pthread_cond_broadcast(&sink->written);
+    }
+    pthread_mutex_unlock(&sink->lock);
+    return NULL;
+}
+
+static resultSink *createResultSink(const char *directory, const spectocolResultFormat format) {
+    resultSink *sink = (resultSink *)calloc(1, sizeof(resultSink));
+    sink->directory = copyString(directory);
+    sink->format = format;
+    pthread_mutex_init(&sink->lock, NULL);
+    pthread_cond_init(&sink->queued, NULL);
+    pthread_cond_init(&sink->written, NULL);
+    if(pthread_create(&sink->writer, NULL, resultWriterLoop, sink) != 0) {
+        printf("Error: The result writer couldn't be started.\n");
+        pthread_cond_destroy(&sink->queued);
+        pthread_cond_destroy(&sink->written);
+        pthread_mutex_destroy(&sink->lock);
+        free(sink->directory);
+        free(sink);
+        return NULL;
+    }
+    return sink;
+}
+
+// writes everything that is still queued, then stops the writer
+static void closeResultSink(resultSink *sink) {
+    if(!sink)
+        return;
+    pthread_mutex_lock(&sink->lock);
+    sink->closed = true;
+    pthread_cond_signal(&sink->queued);
+    pthread_mutex_unlock(&sink->lock);
+    pthread_join(sink->writer, NULL);
+
+    pthread_cond_destroy(&sink->queued);
+    pthread_cond_destroy(&sink->written);
+    pthread_mutex_destroy(&sink->lock);
+    free(sink->directory);
+    free(sink);
+}
+
+// queue a copy of a spectrum, it is written to <directory>/<name>.txt or .bin
+static void submitResult(resultSink *sink, const char *name, const spectrum *table) {
+    const size_t wavelength_bytes = table->wavelength ? table->count * sizeof(float) : 0;
+    const size_t size = sizeof(resultRecord) + table->count * sizeof(double) + wavelength_bytes;
+    resultRecord *record = (resultRecord *)malloc(size);
+    record->next = NULL;
+    record->size = size;
+    snprintf(record->name, RESULT_NAME_MAX, "%s", name);
+    record->count = table->count;
+    record->start = table->start;
+    record->step = table->step;
+    record->intensity = (double *)(record + 1);
+    memcpy(record->intensity, table->intensity, table->count * sizeof(double));
+    record->wavelength = wavelength_bytes ? (float *)(record->intensity + table->count) : NULL;
+    if(record->wavelength)
+        memcpy(record->wavelength, table->wavelength, wavelength_bytes);
+
+    pthread_mutex_lock(&sink->lock);
+    while(sink->queued_bytes > 0 && sink->queued_bytes + size > RESULT_QUEUE_BYTES_MAX)
+        pthread_cond_wait(&sink->written, &sink->lock);
+    if(sink->tail)
+        sink->tail->next = record;
+    else
+        sink->head = record;
+    sink->tail = record;
+    sink->queued_bytes += size;
+    pthread_cond_signal(&sink->queued);
+    pthread_mutex_unlock(&sink->lock);
+}
+
+// ========================================================
+// context - the registry with the cie matching functions,
+// the weighted cmf cache and the mapped database. Every
+// conversion reaches its tables through a context, so
+// independent contexts never share any state.
+// ========================================================
+struct spectocolContext {
+    spectrumRegistry registry;
+    spectrum *cie_x;    // owned by the registry
+    spectrum *cie_y;
+    spectrum *cie_z;
+
+    struct weightedCmf **weighted_cmf_cache;
+    int weighted_cmf_count;
+    pthread_mutex_t weighted_cmf_lock;
+
+    void *database_mapping;
+    size_t database_size;
+
+    // if set, the sampled functions of every conversion are
+    // written for plotting, NULL = off
+    resultSink *results;
+
+    spectocolSequence sequence;     // wavelengths of random and hero sampling
+    uint64_t seed;                  // of their pseudo random numbers
+    uint64_t single_conversions;    // streams handed out to single conversions, atomic
+    spectocolImportance importance; // pdf of those wavelengths
+
+    // workers of all parallel calls, created by the first one with its
+    // number of threads and joined when the context is deleted
+    struct threadPool *pool;
+    pthread_mutex_t pool_lock;
+};
+
+// streams of single conversions have the top bit set, so they never meet the request indices of a batch
+#define SINGLE_STREAM_BASE ((uint64_t)1 << 63)
+
+// the stream of the next single conversion: the n-th one after setting the seed always gets the same
+static uint64_t getSingleStream(spectocolContext *ctx) {
+    return SINGLE_STREAM_BASE + __atomic_fetch_add(&ctx->single_conversions, 1, __ATOMIC_RELAXED);
+}
+
+// a context on a grid, the default grid if it is NULL. NULL if the grid is invalid
+static struct spectocolContext *createContext(const spectocolGrid *grid) {
+    spectralGrid checked;
+    bool valid = grid ? setUpGrid(&checked, grid->lower, grid->upper, grid->step)
+                      : setUpGrid(&checked, VISIBLE_SPECTRUM_LOWER_BOUND, VISIBLE_SPECTRUM_UPPER_BOUND, VISIBLE_SPECTRUM_STEP);
+    if(!valid) {
+        printf("The spectral grid %g-%gnm in steps of %gnm is invalid.\n", grid->lower, grid->upper, grid->step);
+        return NULL;
+    }
+
+    spectocolContext *ctx = (struct spectocolContext *)calloc(1, sizeof(struct spectocolContext));
+    ctx->registry.grid = checked;
+    ctx->seed = time(0);
+    pthread_mutex_init(&ctx->registry.lock, NULL);
+    pthread_mutex_init(&ctx->weighted_cmf_lock, NULL);
+    pthread_mutex_init(&ctx->pool_lock, NULL);
+    return ctx;
+}
+
+// register the spectra compiled into the library. On the grid they were generated for their
+// tables are used in place, on any other grid they are interpolated from their samples on first use
+static void registerBuiltinSpectra(spectrumRegistry *registry) {
+    for(int i = 0; i < BUILTIN_SPECTRUM_COUNT; i++) {
+        const builtinSpectrum *builtin = &builtin_spectra[i];
+        spectrum *table = createMappedSpectrum(BUILTIN_GRID_LOWER, BUILTIN_GRID_STEP, BUILTIN_GRID_COUNT,
+                                               (double *)builtin->table);
+        if(!isOnGrid(table, &registry->grid)) {
+            deleteSpectrum(table);
+            table = NULL;
+        }
+        registryEntry *entry = registerSpectrum(registry, builtin->name, NULL, builtin->kind, table);
+        if(entry == NULL)
+            deleteSpectrum(table);
+        else
+            entry->builtin = builtin;
+    }
+}
+
+// register the spectra of the data directories and the built-in ones, then load the cie
+// matching functions. Given data directories take precedence over the built-in spectra,
+// the default directory only adds spectra that are not built in
+static bool setUpRegistry(spectocolContext *ctx, char **data_directories, int directory_count) {
+    for(int i = 0; i < directory_count; i++)
+        scanDataDirectory(&ctx->registry, data_directories[i]);
+    registerBuiltinSpectra(&ctx->registry);
+    if(directory_count == 0)
+        scanDataDirectory(&ctx->registry, DEFAULT_DATA_DIRECTORY);
+
+    for(size_t i = 0; i < sizeof(builtin_aliases) / sizeof(builtin_aliases[0]); i++)
+        registerAlias(&ctx->registry, builtin_aliases[i][0], builtin_aliases[i][1]);
+
+    ctx->cie_x = getSpectrum(&ctx->registry, "cie_x", SPECTOCOL_CMF);
+    ctx->cie_y = getSpectrum(&ctx->registry, "cie_y", SPECTOCOL_CMF);
+    ctx->cie_z = getSpectrum(&ctx->registry, "cie_z", SPECTOCOL_CMF);
+    if(!ctx->cie_x || !ctx->cie_y || !ctx->cie_z) {
+        printf("The CIE matching functions cie_x, cie_y and cie_z could not be found.\n");
+        return false;
+    }
+    return true;
+}
+
+// ========================================================
+// binary spectral database
+// layout (native byte order):
+//   header     magic, version, number of spectra
+//   directory  one entry per spectrum: name, kind, grid, payload offset
+//   payloads   interpolated float64 intensities, each one
+//              starting on a cache line
+// the file is mapped read-only and its spectra are registered
+// with tables that point straight into the mapping, nothing
+// is parsed or copied at startup
+// ========================================================
+#define DATABASE_MAGIC "SPECTDB"
+#define DATABASE_VERSION 2
+#define DATABASE_NAME_MAX 32
+
+typedef struct databaseHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t count;
+    uint64_t directory_offset;
+    uint64_t file_size;
+    char reserved[32];
+} databaseHeader;
+
+typedef struct databaseEntry {
+    char name[DATABASE_NAME_MAX];
+    float start;
+    float step;
+    int32_t count;
+    uint32_t kind;
+    uint64_t offset;
+    uint64_t reserved;
+} databaseEntry;
+
+static uint64_t alignToCacheLine(const uint64_t offset) {
+    return (offset + CACHE_LINE_SIZE - 1) / CACHE_LINE_SIZE * CACHE_LINE_SIZE;
+}
+
+// write every registered spectrum to a database file, loading them if needed
+static bool writeDatabase(spectrumRegistry *registry, const char *filename) {
+    databaseEntry *entries = (databaseEntry *)calloc(registry->count > 0 ? registry->count : 1, sizeof(databaseEntry));
+    spectrum **tables = (spectrum **)calloc(registry->count > 0 ? registry->count : 1, sizeof(spectrum *));
+    int count = 0;
+
+    for(int i = 0; i < registry->bucket_count; i++) {
+        for(registryEntry *entry = registry->buckets[i]; entry != NULL; entry = entry->next) {
+            if(entry->alias_of != NULL)
+                continue;
+            if(strlen(entry->name) >= DATABASE_NAME_MAX) {
+                printf("Name of spectrum %s is too long for the database, skipped.\n", entry->name);
+                continue;
+            }
+            spectrum *table = getSpectrum(registry, entry->name, entry->kind);
+            if(table == NULL) {
+                printf("Spectrum %s could not be loaded, skipped.\n", entry->name);
+                continue;
+            }
+            snprintf(entries[count].name, DATABASE_NAME_MAX, "%s", entry->name);
+            entries[count].kind = entry->kind;
+            tables[count++] = table;
+        }
+    }
+
+    databaseHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, DATABASE_MAGIC, sizeof(DATABASE_MAGIC));
+    header.version = DATABASE_VERSION;
+    header.count = count;
+    header.directory_offset = sizeof(databaseHeader);
+
+    uint64_t offset = alignToCacheLine(header.directory_offset + count * sizeof(databaseEntry));
+    for(int i = 0; i < count; i++) {
+        entries[i].start = tables[i]->start;
+        entries[i].step = tables[i]->step;
+        entries[i].count = tables[i]->count;
+        entries[i].offset = offset;
+        offset = alignToCacheLine(offset + tables[i]->count * sizeof(double));
+    }
+    header.file_size = offset;
+
+    FILE *db_file = fopen(filename, "wb");
+    if(db_file == NULL) {
+        printf("Database file %s could not be created.\n", filename);
+        free(entries);
+        free(tables);
+        return false;
+    }
+
+    bool ok = fwrite(&header, sizeof(header), 1, db_file) == 1
+              && fwrite(entries, sizeof(databaseEntry), count, db_file) == (size_t)count;
+
+    const char padding[CACHE_LINE_SIZE] = {0};
+    for(int i = 0; i < count && ok; i++) {
+        long position = ftell(db_file);
+        ok = fwrite(padding, 1, entries[i].offset - position, db_file) == entries[i].offset - position
+             && fwrite(tables[i]->intensity, sizeof(double), tables[i]->count, db_file) == (size_t)tables[i]->count;
+    }
+    long position = ftell(db_file);
+    ok = ok && fwrite(padding, 1, header.file_size - position, db_file) == header.file_size - position;
+
+    free(entries);
+    free(tables);
+    if(fclose(db_file) != 0 || !ok) {
+        printf("Error while writing database file %s.\n", filename);
+        return false;
+    }
+    printf("Compiled %d spectra into %s.\n", count, filename);
+    return true;
+}
+
+static void unloadDatabase(spectocolContext *ctx) {
+    if(ctx->database_mapping != NULL)
+        munmap(ctx->database_mapping, ctx->database_size);
+    ctx->database_mapping = NULL;
+    ctx->database_size = 0;
+}
+
+// map a database file and register all of its spectra
+static bool loadDatabase(spectocolContext *ctx, const char *filename) {
+    int fd = open(filename, O_RDONLY);
+    if(fd < 0) {
+        printf("Database file %s could not be opened.\n", filename);
+        return false;
+    }
+
+    struct stat file_stat;
+    if(fstat(fd, &file_stat) != 0 || (size_t)file_stat.st_size < sizeof(databaseHeader)) {
+        printf("Database file %s is too small.\n", filename);
+        close(fd);
+        return false;
+    }
+
+    ctx->database_size = file_stat.st_size;
+    ctx->database_mapping = mmap(NULL, ctx->database_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(ctx->database_mapping == MAP_FAILED) {
+        printf("Database file %s could not be mapped.\n", filename);
+        ctx->database_mapping = NULL;
+        return false;
+    }
+
+    const char *base = (const char *)ctx->database_mapping;
+    const databaseHeader *header = (const databaseHeader *)base;
+    if(memcmp(header->magic, DATABASE_MAGIC, sizeof(DATABASE_MAGIC)) != 0
+       || header->version != DATABASE_VERSION
+       || header->file_size != ctx->database_size
+       || header->directory_offset + (uint64_t)header->count * sizeof(databaseEntry) > ctx->database_size) {
+        printf("Database file %s is invalid or was built by another version.\n", filename);
+        unloadDatabase(ctx);
+        return false;
+    }
+
+    const databaseEntry *entries = (const databaseEntry *)(base + header->directory_offset);
+    for(uint32_t i = 0; i < header->count; i++) {
+        const databaseEntry *entry = &entries[i];
+        if(entry->count <= 0 || entry->offset % CACHE_LINE_SIZE != 0 || entry->kind > SPECTOCOL_CMF
+           || memchr(entry->name, '\0', DATABASE_NAME_MAX) == NULL
+           || entry->offset + (uint64_t)entry->count * sizeof(double) > ctx->database_size) {
+            printf("Database file %s has a corrupt entry.\n", filename);
+            deleteRegistry(&ctx->registry);
+            unloadDatabase(ctx);
+            return false;
+        }
+
+        // the mapping is read-only, so every table has to be interpolated already
+        const double *intensity = (const double *)(base + entry->offset);
+        for(int j = 0; j < entry->count; j++) {
+            if(intensity[j] == NOT_IN_TABLE) {
+                printf("Spectrum %s in database file %s is not interpolated.\n", entry->name, filename);
+                deleteRegistry(&ctx->registry);
+                unloadDatabase(ctx);
+                return false;
+            }
+        }
+
+        spectrum *table = createMappedSpectrum(entry->start, entry->step, entry->count, (double *)intensity);
+        if(!isOnGrid(table, &ctx->registry.grid)) {
+            printf("Database file %s was compiled for another spectral grid.\n", filename);
+            deleteSpectrum(table);
+            deleteRegistry(&ctx->registry);
+            unloadDatabase(ctx);
+            return false;
+        }
+        if(registerSpectrum(&ctx->registry, entry->name, NULL, entry->kind, table) == NULL)
+            deleteSpectrum(table);
+    }
+    return true;
+}
+
+// fill the registry, first from a database file and then from the data directories
+static bool loadTables(spectocolContext *ctx, const char *database_filename, char **data_directories, int directory_count) {
+    if(database_filename != NULL) {
+        profileScope scope = profileBegin(PROFILE_LOAD_DATABASE);
+        bool loaded = loadDatabase(ctx, database_filename);
+        profileEnd(&scope, ctx->registry.count);
+        if(!loaded)
+            printf("Falling back to the text files in the data folder.\n");
+    }
+    return setUpRegistry(ctx, data_directories, directory_count);
+}
+
+// ========================================================
+// illuminant-weighted colour matching functions
+// l * cie_x/y/z does not depend on the reflectance, so it
+// is computed once per luminaire of the context and kept
+// as long as the context. For fixed sampling the trapezoid
+// weights are folded in as well, so a reflectance costs
+// three dot products. The inverse cdf tables of importance
+// sampling are kept next to them. Luminaires the context
+// does not own get weighted cmfs for a single conversion only.
+// ========================================================
+#define FIXED_SAMPLES_MAX SPECTOCOL_FIXED_SAMPLES_MAX
+#define IMPORTANCE_PDFS (SPECTOCOL_IMPORTANCE_LUMINAIRE_Y + 1)
+#define IMPORTANCE_GUIDE_SIZE 512
+#define IMPORTANCE_UNIFORM_SHARE 0.25   // mixed into every pdf, so no wavelength and no channel is starved
+
+// piecewise linear pdf over the range of the grid, linear between its values at the grid
+// wavelengths. cdf holds its integral up to every grid wavelength, the guide table the first
+// segment of every 1 / IMPORTANCE_GUIDE_SIZE step of the cdf, so inverting it is O(1).
+// pdf and cdf live in the same allocation, behind the table
+typedef struct importanceTable {
+    int count;
+    double lower;
+    double step;
+    double *pdf;    // per nm, at the grid wavelengths
+    double *cdf;
+    int guide[IMPORTANCE_GUIDE_SIZE];
+} importanceTable;
+
+typedef struct weightedCmf {
+    const spectrum *luminaire;
+    spectrum *x;    // l * cie_x on the grid of the context
+    spectrum *y;
+    spectrum *z;
+    double *fixed[FIXED_SAMPLES_MAX + 1][3];    // w * l * cie at the fixed sample positions, per sample count
+    double *full_grid[3];                       // the same with a sample at every grid wavelength
+    importanceTable *importance[IMPORTANCE_PDFS];
+} weightedCmf;
+
+// number of grid steps between two fixed samples, 0 if the grid is too coarse for num_samples
+static int getFixedStride(const spectralGrid *grid, const int num_samples) {
+    return (grid->count - 1) / (num_samples - 1);
+}
+
+static struct weightedCmf *createWeightedCmf(spectocolContext *ctx, const spectrum *luminaire) {
+    profileScope scope = profileBegin(PROFILE_WEIGHTED_CMF);
+    weightedCmf *cmf = (struct weightedCmf *)calloc(1, sizeof(struct weightedCmf));
+    cmf->luminaire = luminaire;
+    cmf->x = pointwiseMultipication(luminaire, ctx->cie_x);
+    cmf->y = pointwiseMultipication(luminaire, ctx->cie_y);
+    cmf->z = pointwiseMultipication(luminaire, ctx->cie_z);
+    profileEnd(&scope, 3 * luminaire->count);
+    return cmf;
+}
+
+static void deleteWeightedCmf(struct weightedCmf *cmf) {
+    deleteSpectrum(cmf->x);
+    deleteSpectrum(cmf->y);
+    deleteSpectrum(cmf->z);
+    for(int n = 0; n <= FIXED_SAMPLES_MAX; n++) {
+        for(int c = 0; c < 3; c++)
+            free(cmf->fixed[n][c]);
+    }
+    for(int c = 0; c < 3; c++)
+        free(cmf->full_grid[c]);
+    for(int i = 0; i < IMPORTANCE_PDFS; i++)
+        free(cmf->importance[i]);
+    free(cmf);
+}
+
+static void deleteWeightedCmfCache(spectocolContext *ctx) {
+    for(int i = 0; i < ctx->weighted_cmf_count; i++)
+        deleteWeightedCmf(ctx->weighted_cmf_cache[i]);
+    free(ctx->weighted_cmf_cache);
+    ctx->weighted_cmf_cache = NULL;
+    ctx->weighted_cmf_count = 0;
+}
+
+// get the weighted cmfs of an (already interpolated) luminaire, build them on first use
+// every call has to be paired with releaseWeightedCmf
+static struct weightedCmf *getWeightedCmf(spectocolContext *ctx, const spectrum *luminaire) {
+    if(!luminaire->registered)
+        return createWeightedCmf(ctx, luminaire);
+
+    pthread_mutex_lock(&ctx->weighted_cmf_lock);
+    for(int i = 0; i < ctx->weighted_cmf_count; i++) {
+        if(ctx->weighted_cmf_cache[i]->luminaire == luminaire) {
+            pthread_mutex_unlock(&ctx->weighted_cmf_lock);
+            return ctx->weighted_cmf_cache[i];
+        }
+    }
+
+    weightedCmf *cmf = createWeightedCmf(ctx, luminaire);
+    ctx->weighted_cmf_cache = (weightedCmf **)realloc(ctx->weighted_cmf_cache,
+                                                      (ctx->weighted_cmf_count + 1) * sizeof(weightedCmf *));
+    ctx->weighted_cmf_cache[ctx->weighted_cmf_count++] = cmf;
+    pthread_mutex_unlock(&ctx->weighted_cmf_lock);
+    return cmf;
+}
+
+// cached weighted cmfs stay, the ones of a luminaire the context does not own are deleted
+static void releaseWeightedCmf(struct weightedCmf *cmf) {
+    if(!cmf->luminaire->registered)
+        deleteWeightedCmf(cmf);
+}
+
+// get w * l * cie_x/y/z at the positions of fixed sampling with num_samples samples,
+// up to FIXED_SAMPLES_MAX or one at every wavelength of the grid
+static double **getFixedWeightedCmf(spectocolContext *ctx, struct weightedCmf *cmf, const int num_samples) {
+    const bool full_grid = num_samples == ctx->registry.grid.count;
+    assert(num_samples >= 2 && (num_samples <= FIXED_SAMPLES_MAX || full_grid));
+
+    pthread_mutex_lock(&ctx->weighted_cmf_lock);
+    double **fixed = full_grid ? cmf->full_grid : cmf->fixed[num_samples];
+    if(fixed[0] == NULL) {
+        const int stride = getFixedStride(&ctx->registry.grid, num_samples);
+        double *weights = (double *)allocAligned(num_samples * sizeof(double));
+        trapezoidWeightsUniform(weights, num_samples, stride * ctx->registry.grid.step);
+
+        const spectrum *grid[3] = {cmf->x, cmf->y, cmf->z};
+        for(int c = 0; c < 3; c++) {
+            fixed[c] = (double *)allocAligned(num_samples * sizeof(double));
+            for(int j = 0; j < num_samples; j++)
+                fixed[c][j] = weights[j] * lookupAtIndex(grid[c], j * stride);
+        }
+        free(weights);
+    }
+    pthread_mutex_unlock(&ctx->weighted_cmf_lock);
+    return fixed;
+}
+
+// unnormalised pdf of importance sampling at the i-th wavelength of the grid
+static double getImportanceWeight(spectocolContext *ctx, const struct weightedCmf *cmf,
+                                  const spectocolImportance importance, const int i) {
+    switch(importance) {
+        case SPECTOCOL_IMPORTANCE_LUMINAIRE:
+            return lookupAtIndex(cmf->luminaire, i);
+        case SPECTOCOL_IMPORTANCE_Y:
+            return lookupAtIndex(ctx->cie_y, i);
+        case SPECTOCOL_IMPORTANCE_XYZ:
+            return lookupAtIndex(ctx->cie_x, i) + lookupAtIndex(ctx->cie_y, i) + lookupAtIndex(ctx->cie_z, i);
+        case SPECTOCOL_IMPORTANCE_LUMINAIRE_Y:
+            return lookupAtIndex(cmf->y, i);
+        default:
+            return 1;
+    }
+}
+
+static struct importanceTable *createImportanceTable(spectocolContext *ctx, const struct weightedCmf *cmf,
+                                                     const spectocolImportance importance) {
+    const spectralGrid *grid = &ctx->registry.grid;
+    const int count = grid->count;
+    const double range = (count - 1) * grid->step;
+    importanceTable *table = (struct importanceTable *)allocAligned(sizeof(struct importanceTable)
+                                                                    + 2 * count * sizeof(double));
+    table->count = count;
+    table->lower = grid->lower;
+    table->step = grid->step;
+    table->pdf = (double *)(table + 1);
+    table->cdf = table->pdf + count;
+
+    // trapezoid integral of the weights, the integral of their linear interpolation
+    for(int i = 0; i < count; i++)
+        table->pdf[i] = fmax(getImportanceWeight(ctx, cmf, importance, i), 0);
+    double sum = 0;
+    for(int i = 0; i < count - 1; i++)
+        sum += (table->pdf[i] + table->pdf[i + 1]) / 2 * grid->step;
+    for(int i = 0; i < count; i++) {
+        double share = sum > 0 ? (1 - IMPORTANCE_UNIFORM_SHARE) * table->pdf[i] / sum : 0;
+        table->pdf[i] = share + (sum > 0 ? IMPORTANCE_UNIFORM_SHARE : 1.0) / range;
+    }
+
+    table->cdf[0] = 0;
+    for(int i = 0; i < count - 1; i++)
+        table->cdf[i + 1] = table->cdf[i] + (table->pdf[i] + table->pdf[i + 1]) / 2 * grid->step;
+    table->cdf[count - 1] = 1;
+
+    int i = 0;
+    for(int g = 0; g < IMPORTANCE_GUIDE_SIZE; g++) {
+        while(i < count - 2 && table->cdf[i + 1] <= (double)g / IMPORTANCE_GUIDE_SIZE)
+            i++;
+        table->guide[g] = i;
+    }
+    return table;
+}
+
+// get the inverse cdf table of a pdf for the luminaire of cmf, NULL for uniform sampling
+static const struct importanceTable *getImportanceTable(spectocolContext *ctx, struct weightedCmf *cmf,
+                                                        const spectocolImportance importance) {
+    if(importance == SPECTOCOL_IMPORTANCE_UNIFORM)
+        return NULL;
+
+    pthread_mutex_lock(&ctx->weighted_cmf_lock);
+    if(cmf->importance[importance] == NULL)
+        cmf->importance[importance] = createImportanceTable(ctx, cmf, importance);
+    pthread_mutex_unlock(&ctx->weighted_cmf_lock);
+    return cmf->importance[importance];
+}
+
+// invert the cdf at u in [0, 1): the wavelength in nm and its pdf. Inside its segment the pdf
+// is p0 + (p1 - p0) x / step, so the offset x solves p0 x + (p1 - p0) x^2 / (2 step) = u - cdf.
+// The mapping is monotonic, so low discrepancy samples stay well distributed
+static double sampleImportance(const struct importanceTable *table, const double u, double *pdf) {
+    int i = table->guide[(int)(u * IMPORTANCE_GUIDE_SIZE)];
+    while(i < table->count - 2 && table->cdf[i + 1] <= u)
+        i++;
+
+    const double p0 = table->pdf[i];
+    const double slope = (table->pdf[i + 1] - p0) / table->step;
+    const double d = fmax(u - table->cdf[i], 0);
+    // the root of the quadratic in the form without cancellation, p0 > 0 by the uniform share
+    double x = 2 * d / (p0 + sqrt(fmax(p0 * p0 + 2 * slope * d, 0)));
+    x = fmin(x, table->step);
+    *pdf = p0 + slope * x;
+    return table->lower + i * table->step + x;
+}
+
+// evaluate a table at the sample positions of another spectrum
+static struct spectrum *sampleAtWavelengths(const spectrum *table, const spectrum *positions) {
+    spectrum *res = createSampledSpectrum(positions->count);
+    for(int i = 0; i < positions->count; i++) {
+        float wl = positions->wavelength[i];
+        addNodeToFixedTable(res, i, wl, interpolateAtWl(table, wl));
+    }
+    return res;
+}
+
+// write the sampled luminaire, reflectance and their product for plotting
+static void submitSampledFunctions(resultSink *sink, const spectrum *l_func, const spectrum *r_samples,
+                                   const char *l_name, const char *r_name, const char *res_name) {
+    spectrum *l_samples = sampleAtWavelengths(l_func, r_samples);
+    spectrum *res_spec = pointwiseMultipication(l_samples, r_samples);
+
+    submitResult(sink, l_name, l_samples);
+    submitResult(sink, r_name, r_samples);
+    submitResult(sink, res_name, res_spec);
+
+    deleteSpectrum(l_samples);
+    deleteSpectrum(res_spec);
+}
+
+// ========================================================
+// the actual main part of this homework assignment
+// calculation and conversion from spectral information
+// to colour
+// ========================================================
+static int compareDoubles(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+// importance sampled wavelengths. The integral over the wavelengths is the integral of f / pdf over
+// the cdf values u in [0, 1), so like uniform random sampling the samples are sorted and integrated
+// with the trapezoid rule, in u: every sample is weighted by half the cdf spacing to its neighbours
+// (the first and last also cover the ends) and divided by its pdf.
+// Hero sampling rotates the first sample through the cdf in steps of 1 / num_samples, so its
+// wavelengths are stratified in proportion to the pdf and every spacing is 1 / num_samples
+static void importanceSpectrumToXyz(spectocolContext *ctx, int num_samples, const spectrum* l_func,
+                                    const spectrum* r_func, const bool hero, const uint64_t stream, float cie[3]) {
+
+    profileScope scope = profileBegin(PROFILE_IMPORTANCE);
+    weightedCmf *cmf = getWeightedCmf(ctx, l_func);
+    const importanceTable *table = getImportanceTable(ctx, cmf, ctx->importance);
+
+    arena *a = getThreadArena();
+    arenaMark mark = arenaSave(a);
+
+    spectrum *cie_x_imp = createArenaSpectrum(a, num_samples);
+    spectrum *cie_y_imp = createArenaSpectrum(a, num_samples);
+    spectrum *cie_z_imp = createArenaSpectrum(a, num_samples);
+    double *weights = (double *)arenaAlloc(a, num_samples * sizeof(double));
+
+    wavelengthSampler sampler;
+    initSampler(&sampler, ctx->sequence, ctx->seed, stream, 0);
+    double *u = (double *)arenaAlloc(a, num_samples * sizeof(double));
+    const double hero_sample = getNextSample(&sampler);
+    for(int i = 0; i < num_samples; i++)
+        u[i] = hero ? wrapToUnit(hero_sample + (double)i / num_samples) : getNextSample(&sampler);
+
+    if(!hero && num_samples > 1) {
+        profileScope sort_scope = profileBegin(PROFILE_SORT);
+        qsort(u, num_samples, sizeof(double), compareDoubles);
+        profileEnd(&sort_scope, num_samples);
+    }
+
+    for(int i = 0; i < num_samples; i++) {
+        double spacing = 1.0 / num_samples;
+        if(!hero && num_samples > 1) {
+            double left = i == 0 ? 2 * u[0] : u[i] - u[i - 1];
+            double right = i == num_samples - 1 ? 2 * (1 - u[i]) : u[i + 1] - u[i];
+            spacing = (left + right) / 2;
+        }
+        double pdf;
+        double wl = sampleImportance(table, u[i], &pdf);
+        weights[i] = interpolateAtWl(r_func, wl) * spacing / pdf;
+        addNodeToFixedTable(cie_x_imp, i, wl, interpolateAtWl(cmf->x, wl));
+        addNodeToFixedTable(cie_y_imp, i, wl, interpolateAtWl(cmf->y, wl));
+        addNodeToFixedTable(cie_z_imp, i, wl, interpolateAtWl(cmf->z, wl));
+    }
+
+    double xyz[3];
+    dotXyz(weights, cie_x_imp->intensity, cie_y_imp->intensity, cie_z_imp->intensity, num_samples, xyz);
+
+    cie[0] = xyz[0];
+    cie[1] = xyz[1];
+    cie[2] = xyz[2];
+
+    arenaRestore(a, mark);
+    releaseWeightedCmf(cmf);
+    profileEnd(&scope, num_samples);
+}
+
+// hero wavelength sampling on the continuous range of the grid. A hero wavelength is drawn,
+// its num_samples - 1 companions are rotated by multiples of range / num_samples, so the
+// set is {lower + offset + j * range / num_samples} with a random offset below the spacing.
+// Every sample stands for one spacing of the range.
+
+// the samples of a hero conversion, all spectra lie on the same grid of count values
+typedef struct heroPacket {
+    const double *r;
+    const double *x;
+    const double *y;
+    const double *z;
+    int count;
+    double start;
+    double step;
+    double first;        // wavelength of sample 0
+    double spacing;
+    int num_samples;
+} heroPacket;
+
+// xyz = sum over the samples of spacing * r * (x, y, z), interpolated at the sample wavelengths
+typedef void (*heroKernel)(const heroPacket *packet, double xyz[3]);
+
+static double interpolateArray(const double *values, const int count, const double start, const double step,
+                               const double wl) {
+    double x = (wl - start) / step;
+    int i = (int)x;
+    if(i >= count - 1)
+        return values[count - 1];
+    double t = x - i;
+    return values[i] + t * (values[i + 1] - values[i]);
+}
+
+static void heroSamples(const heroPacket *p, const int first, double xyz[3]) {
+    double sum_x = 0, sum_y = 0, sum_z = 0;
+    for(int k = first; k < p->num_samples; k++) {
+        double wl = p->first + k * p->spacing;
+        double s = p->spacing * interpolateArray(p->r, p->count, p->start, p->step, wl);
+        sum_x += interpolateArray(p->x, p->count, p->start, p->step, wl) * s;
+        sum_y += interpolateArray(p->y, p->count, p->start, p->step, wl) * s;
+        sum_z += interpolateArray(p->z, p->count, p->start, p->step, wl) * s;
+    }
+    xyz[0] = sum_x;
+    xyz[1] = sum_y;
+    xyz[2] = sum_z;
+}
+
+static void heroScalar(const heroPacket *p, double xyz[3]) {
+    heroSamples(p, 0, xyz);
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+// the lanes gather the grid values around their wavelength, a lane past the last grid value
+// takes that value like interpolateAtWl
+static inline __attribute__((target("avx2")))
+__m256d gatherInterpolate4(const double *values, __m128i i, __m256d t, __m256d at_end) {
+    __m256d lower = _mm256_i32gather_pd(values, i, 8);
+    __m256d upper = _mm256_i32gather_pd(values + 1, i, 8);
+    __m256d value = _mm256_add_pd(lower, _mm256_mul_pd(t, _mm256_sub_pd(upper, lower)));
+    return _mm256_blendv_pd(value, upper, at_end);
+}
+
+static __attribute__((target("avx2")))
+void heroAvx2(const heroPacket *p, double xyz[3]) {
+    const __m256d first = _mm256_set1_pd(p->first);
+    const __m256d spacing = _mm256_set1_pd(p->spacing);
+    const __m256d start = _mm256_set1_pd(p->start);
+    const __m256d step = _mm256_set1_pd(p->step);
+    const __m256d last = _mm256_set1_pd(p->count - 1);
+    const __m128i last_segment = _mm_set1_epi32(p->count - 2);
+    const __m256d lanes = _mm256_set_pd(3, 2, 1, 0);
+
+    __m256d sum_x = _mm256_setzero_pd();
+    __m256d sum_y = _mm256_setzero_pd();
+    __m256d sum_z = _mm256_setzero_pd();
+
+    int k = 0;
+    for(; k + 4 <= p->num_samples; k += 4) {
+        __m256d index = _mm256_add_pd(_mm256_set1_pd(k), lanes);
+        __m256d wl = _mm256_add_pd(first, _mm256_mul_pd(index, spacing));
+        __m256d x = _mm256_div_pd(_mm256_sub_pd(wl, start), step);
+        __m128i i = _mm_min_epi32(_mm256_cvttpd_epi32(x), last_segment);
+        __m256d t = _mm256_sub_pd(x, _mm256_cvtepi32_pd(i));
+        __m256d at_end = _mm256_cmp_pd(x, last, _CMP_GE_OQ);
+
+        __m256d s = _mm256_mul_pd(spacing, gatherInterpolate4(p->r, i, t, at_end));
+        sum_x = _mm256_add_pd(sum_x, _mm256_mul_pd(gatherInterpolate4(p->x, i, t, at_end), s));
+        sum_y = _mm256_add_pd(sum_y, _mm256_mul_pd(gatherInterpolate4(p->y, i, t, at_end), s));
+        sum_z = _mm256_add_pd(sum_z, _mm256_mul_pd(gatherInterpolate4(p->z, i, t, at_end), s));
+    }
+
+    double lanes_xyz[3][4];
+    _mm256_storeu_pd(lanes_xyz[0], sum_x);
+    _mm256_storeu_pd(lanes_xyz[1], sum_y);
+    _mm256_storeu_pd(lanes_xyz[2], sum_z);
+
+    heroSamples(p, k, xyz);
+    for(int c = 0; c < 3; c++)
+        xyz[c] += (lanes_xyz[c][0] + lanes_xyz[c][1]) + (lanes_xyz[c][2] + lanes_xyz[c][3]);
+}
+
+static inline __attribute__((target("avx512f")))
+__m512d gatherInterpolate8(const double *values, __m256i i, __m512d t, __mmask8 at_end) {
+    __m512d lower = _mm512_i32gather_pd(i, values, 8);
+    __m512d upper = _mm512_i32gather_pd(i, values + 1, 8);
+    __m512d value = _mm512_add_pd(lower, _mm512_mul_pd(t, _mm512_sub_pd(upper, lower)));
+    return _mm512_mask_blend_pd(at_end, value, upper);
+}
+
+static __attribute__((target("avx512f")))
+void heroAvx512(const heroPacket *p, double xyz[3]) {
+    const __m512d first = _mm512_set1_pd(p->first);
+    const __m512d spacing = _mm512_set1_pd(p->spacing);
+    const __m512d start = _mm512_set1_pd(p->start);
+    const __m512d step = _mm512_set1_pd(p->step);
+    const __m512d last = _mm512_set1_pd(p->count - 1);
+    const __m256i last_segment = _mm256_set1_epi32(p->count - 2);
+    const __m512d lanes = _mm512_set_pd(7, 6, 5, 4, 3, 2, 1, 0);
+
+    __m512d sum_x = _mm512_setzero_pd();
+    __m512d sum_y = _mm512_setzero_pd();
+    __m512d sum_z = _mm512_setzero_pd();
+
+    int k = 0;
+    for(; k + 8 <= p->num_samples; k += 8) {
+        __m512d index = _mm512_add_pd(_mm512_set1_pd(k), lanes);
+        __m512d wl = _mm512_add_pd(first, _mm512_mul_pd(index, spacing));
+        __m512d x = _mm512_div_pd(_mm512_sub_pd(wl, start), step);
+        __m256i i = _mm256_min_epi32(_mm512_cvttpd_epi32(x), last_segment);
+        __m512d t = _mm512_sub_pd(x, _mm512_cvtepi32_pd(i));
+        __mmask8 at_end = _mm512_cmp_pd_mask(x, last, _CMP_GE_OQ);
+
+        __m512d s = _mm512_mul_pd(spacing, gatherInterpolate8(p->r, i, t, at_end));
+        sum_x = _mm512_add_pd(sum_x, _mm512_mul_pd(gatherInterpolate8(p->x, i, t, at_end), s));
+        sum_y = _mm512_add_pd(sum_y, _mm512_mul_pd(gatherInterpolate8(p->y, i, t, at_end), s));
+        sum_z = _mm512_add_pd(sum_z, _mm512_mul_pd(gatherInterpolate8(p->z, i, t, at_end), s));
+    }
+
+    heroSamples(p, k, xyz);
+    xyz[0] += _mm512_reduce_add_pd(sum_x);
+    xyz[1] += _mm512_reduce_add_pd(sum_y);
+    xyz[2] += _mm512_reduce_add_pd(sum_z);
+}
+#endif
+
+static heroKernel hero_kernel = heroScalar;
+static pthread_once_t hero_kernel_once = PTHREAD_ONCE_INIT;
+
+// the packet width follows the widest kernel the cpu supports, 8 lanes for avx-512, 4 for avx2
+static void selectHeroKernel(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("avx512f"))
+        hero_kernel = heroAvx512;
+    else if(__builtin_cpu_supports("avx2"))
+        hero_kernel = heroAvx2;
+#endif
+}
+
+static heroKernel getHeroKernel(void) {
+    pthread_once(&hero_kernel_once, selectHeroKernel);
+    return hero_kernel;
+}
+
+static void heroSpectrumToXyz(spectocolContext *ctx, int num_samples, const spectrum* l_func, const spectrum* r_func,
+                              const uint64_t stream, float cie[3]) {
+
+    if(ctx->importance != SPECTOCOL_IMPORTANCE_UNIFORM) {
+        importanceSpectrumToXyz(ctx, num_samples, l_func, r_func, true, stream, cie);
+        return;
+    }
+
+    profileScope scope = profileBegin(PROFILE_HERO);
+    const heroKernel kernel = getHeroKernel();
+    const spectralGrid *grid = &ctx->registry.grid;
+    weightedCmf *cmf = getWeightedCmf(ctx, l_func);
+
+    const double range = grid->upper - grid->lower;
+    const double spacing = range / num_samples;
+
+    wavelengthSampler sampler;
+    initSampler(&sampler, ctx->sequence, ctx->seed, stream, 0);
+    const double hero_wavelength = grid->lower + getNextSample(&sampler) * range;
+    const double offset = fmod(hero_wavelength - grid->lower, spacing);
+
+    heroPacket packet = {
+        .r = r_func->intensity, .x = cmf->x->intensity, .y = cmf->y->intensity, .z = cmf->z->intensity,
+        .count = r_func->count, .start = r_func->start, .step = r_func->step,
+        .first = grid->lower + offset, .spacing = spacing, .num_samples = num_samples
+    };
+    double xyz[3];
+    kernel(&packet, xyz);
+
+    // the samples are only kept for plotting
+    if(ctx->results) {
+        arena *a = getThreadArena();
+        arenaMark mark = arenaSave(a);
+        spectrum *r_hero = createArenaSpectrum(a, num_samples);
+        for(int k = 0; k < num_samples; k++) {
+            double wl = packet.first + k * spacing;
+            addNodeToFixedTable(r_hero, k, wl, interpolateAtWl(r_func, wl));
+        }
+
+        submitSampledFunctions(ctx->results, l_func, r_hero,
+                               "rnd_hero_l_func_res", "rnd_hero_r_func_res", "rnd_hero_res_spec");
+
+        spectrum *cie_x_res = sampleAtWavelengths(ctx->cie_x, r_hero);
+        spectrum *cie_y_res = sampleAtWavelengths(ctx->cie_y, r_hero);
+        spectrum *cie_z_res = sampleAtWavelengths(ctx->cie_z, r_hero);
+
+        submitResult(ctx->results, "res_cie_x", cie_x_res);
+        submitResult(ctx->results, "res__cie_y", cie_y_res);
+        submitResult(ctx->results, "res_cie_z", cie_z_res);
+
+        deleteSpectrum(cie_x_res);
+        deleteSpectrum(cie_y_res);
+        deleteSpectrum(cie_z_res);
+        arenaRestore(a, mark);
+    }
+
+    cie[0] = xyz[0];
+    cie[1] = xyz[1];
+    cie[2] = xyz[2];
+
+    releaseWeightedCmf(cmf);
+    profileEnd(&scope, num_samples);
+}
+
+static void rndSpectrumToXyz(spectocolContext *ctx, int num_samples, const spectrum* l_func, const spectrum* r_func,
+                             const uint64_t stream, float cie[3]) {
+
+    if(ctx->importance != SPECTOCOL_IMPORTANCE_UNIFORM) {
+        importanceSpectrumToXyz(ctx, num_samples, l_func, r_func, false, stream, cie);
+        return;
+    }
+
+    profileScope scope = profileBegin(PROFILE_RANDOM);
+    const spectralGrid *grid = &ctx->registry.grid;
+    weightedCmf *cmf = getWeightedCmf(ctx, l_func);
+
+    arena *a = getThreadArena();
+    arenaMark mark = arenaSave(a);
+
+    spectrum *r_rndBuckets = createArenaSpectrum(a, num_samples);
+    spectrum *cie_x_rnd = createArenaSpectrum(a, num_samples);
+    spectrum *cie_y_rnd = createArenaSpectrum(a, num_samples);
+    spectrum *cie_z_rnd = createArenaSpectrum(a, num_samples);
+
+    // the wavelengths are sorted once, as grid indices, before any channel is looked up
+    int *indices = (int *)arenaAlloc(a, num_samples * sizeof(int));
+    wavelengthSampler sampler;
+    initSampler(&sampler, ctx->sequence, ctx->seed, stream, 0);
+    for(int i = 0; i < num_samples; i++)
+        indices[i] = getNextGridIndex(&sampler, grid->count);
+    countingSort(indices, num_samples, grid->count, (int *)arenaAlloc(a, grid->count * sizeof(int)));
+
+    for(int i = 0; i < num_samples; i++) {
+        int j = indices[i];
+        float rndWl = grid->lower + j * grid->step;
+        addNodeToFixedTable(r_rndBuckets, i, rndWl, lookupAtIndex(r_func, j));
+        addNodeToFixedTable(cie_x_rnd, i, rndWl, lookupAtIndex(cmf->x, j));
+        addNodeToFixedTable(cie_y_rnd, i, rndWl, lookupAtIndex(cmf->y, j));
+        addNodeToFixedTable(cie_z_rnd, i, rndWl, lookupAtIndex(cmf->z, j));
+    }
+
+    if(ctx->results) {
+        submitSampledFunctions(ctx->results, l_func, r_rndBuckets,
+                               "rnd_l_func_res", "rnd_r_func_res", "rnd_res_spec");
+
+        spectrum* cie_x_res = pointwiseMultipication(cie_x_rnd, r_rndBuckets);
+        spectrum* cie_y_res = pointwiseMultipication(cie_y_rnd, r_rndBuckets);
+        spectrum* cie_z_res = pointwiseMultipication(cie_z_rnd, r_rndBuckets);
+
+        submitResult(ctx->results, "ciex_res", cie_x_res);
+        submitResult(ctx->results, "ciey_res", cie_y_res);
+        submitResult(ctx->results, "ciez_res", cie_z_res);
+
+        deleteSpectrum(cie_x_res);
+        deleteSpectrum(cie_y_res);
+        deleteSpectrum(cie_z_res);
+    }
+
+    // fold the reflectance into the trapezoid weights
+    double *weights = (double *)arenaAlloc(a, num_samples * sizeof(double));
+    trapezoidWeightsNonuniform(weights, r_rndBuckets->wavelength, num_samples);
+    for(int i = 0; i < num_samples; i++)
+        weights[i] *= r_rndBuckets->intensity[i];
+
+    double xyz[3];
+    dotXyz(weights, cie_x_rnd->intensity, cie_y_rnd->intensity, cie_z_rnd->intensity, num_samples, xyz);
+
+    cie[0] = xyz[0];
+    cie[1] = xyz[1];
+    cie[2] = xyz[2];
+
+    arenaRestore(a, mark);
+    releaseWeightedCmf(cmf);
+    profileEnd(&scope, num_samples);
+}
+
+static void fxdSpectrumToXyz(spectocolContext *ctx, int num_samples, const spectrum* l_func, const spectrum* r_func, float cie[3]) {
+
+    profileScope scope = profileBegin(PROFILE_FIXED);
+    const spectralGrid *grid = &ctx->registry.grid;
+    int stride = getFixedStride(grid, num_samples);
+    weightedCmf *weighted = getWeightedCmf(ctx, l_func);
+    double **cmf = getFixedWeightedCmf(ctx, weighted, num_samples);
+
+    arena *a = getThreadArena();
+    arenaMark mark = arenaSave(a);
+
+    spectrum* r_func_fxd = createArenaSpectrum(a, num_samples);
+
+    for(int j = 0; j < num_samples; j++) {
+        float wl = grid->lower + j * stride * grid->step;
+        addNodeToFixedTable(r_func_fxd, j, wl, lookupAtIndex(r_func, j * stride));
+    }
+
+    if(ctx->results) {
+        submitSampledFunctions(ctx->results, l_func, r_func_fxd,
+                               "fxd_l_func", "fxd_r_func", "fxd_res_spec");
+    }
+
+    double xyz[3];
+    dotXyz(r_func_fxd->intensity, cmf[0], cmf[1], cmf[2], num_samples, xyz);
+
+    cie[0] = xyz[0];
+    cie[1] = xyz[1];
+    cie[2] = xyz[2];
+
+    arenaRestore(a, mark);
+    releaseWeightedCmf(weighted);
+    profileEnd(&scope, num_samples);
+}
+
+// ========================================================
+// streaming random sampling - every sample is folded into
+// a running mean and variance (Welford), nothing is stored.
+// Sampling stops once the estimate is as precise as asked
+// ========================================================
+#define STREAM_SAMPLES_MIN 256      // before that the variance is not trusted
+#define STREAM_CHECK_INTERVAL 64
+#define STREAM_SAMPLERS 16          // independent randomisations of a low discrepancy sequence
+
+typedef struct streamEstimate {
+    long count;
+    double mean[3];
+    double m2[3];       // sum of squared differences from the mean
+} streamEstimate;
+
+static void addStreamSample(streamEstimate *e, const double value[3]) {
+    e->count++;
+    for(int c = 0; c < 3; c++) {
+        double delta = value[c] - e->mean[c];
+        e->mean[c] += delta / e->count;
+        e->m2[c] += delta * (value[c] - e->mean[c]);
+    }
+}
+
+static double getStandardError(const streamEstimate *e, const int c) {
+    if(e->count < 2)
+        return INFINITY;
+    return sqrt(e->m2[c] / (e->count - 1) / e->count);
+}
+
+static double labFunction(const double t) {
+    const double delta = 6.0 / 29.0;
+    if(t > delta * delta * delta)
+        return cbrt(t);
+    return t / (3 * delta * delta) + 4.0 / 29.0;
+}
+
+static void xyzToLab(const double xyz[3], const double white[3], double lab[3]) {
+    double fx = labFunction(xyz[0] / white[0]);
+    double fy = labFunction(xyz[1] / white[1]);
+    double fz = labFunction(xyz[2] / white[2]);
+    lab[0] = 116 * fy - 16;
+    lab[1] = 500 * (fx - fy);
+    lab[2] = 200 * (fy - fz);
+}
+
+// CIELAB distance between the estimate and the estimate moved by one standard error
+// in every component, relative to the white of the luminaire
+static double estimateDeltaE(const double xyz[3], const double error[3], const double white[3]) {
+    double lab[3], moved_lab[3];
+    xyzToLab(xyz, white, lab);
+
+    double sum = 0;
+    for(int c = 0; c < 3; c++) {
+        double moved[3] = {xyz[0], xyz[1], xyz[2]};
+        moved[c] += error[c];
+        xyzToLab(moved, white, moved_lab);
+        for(int k = 0; k < 3; k++)
+            sum += (moved_lab[k] - lab[k]) * (moved_lab[k] - lab[k]);
+    }
+    return sqrt(sum);
+}
+
+// mean and standard error of the sampled integrals. Pseudo random samples are independent,
+// so their own variance is used. Low discrepancy samples are not, there every sampler
+// gives one estimate and the spread of those estimates is used (randomised qmc)
+static void measureStream(const streamEstimate *samples, double sums[][3], const long *counts, const int samplers,
+                          double mean[3], double error[3]) {
+    if(samplers == 1) {
+        for(int c = 0; c < 3; c++) {
+            mean[c] = samples->mean[c];
+            error[c] = getStandardError(samples, c);
+        }
+        return;
+    }
+
+    streamEstimate estimates = {0};
+    for(int s = 0; s < samplers; s++) {
+        if(counts[s] == 0)
+            continue;
+        double value[3] = {sums[s][0] / counts[s], sums[s][1] / counts[s], sums[s][2] / counts[s]};
+        addStreamSample(&estimates, value);
+    }
+    for(int c = 0; c < 3; c++) {
+        mean[c] = estimates.mean[c];
+        error[c] = getStandardError(&estimates, c);
+    }
+}
+
+static void streamSpectrumToXyz(spectocolContext *ctx, const spectrum* l_func, const spectrum* r_func,
+                                const double target_error, const double target_delta_e, const long max_samples,
+                                const uint64_t stream, spectocolEstimate *estimate) {
+
+    profileScope scope = profileBegin(PROFILE_STREAM);
+    weightedCmf *cmf = getWeightedCmf(ctx, l_func);
+    const importanceTable *table = getImportanceTable(ctx, cmf, ctx->importance);
+    const spectralGrid *grid = &ctx->registry.grid;
+    const double white[3] = {integrate_uniform(cmf->x, grid->step), integrate_uniform(cmf->y, grid->step),
+                             integrate_uniform(cmf->z, grid->step)};
+
+    // samples are taken round robin from the samplers
+    const int samplers = ctx->sequence == SPECTOCOL_SEQUENCE_RANDOM ? 1 : STREAM_SAMPLERS;
+    wavelengthSampler sampler[STREAM_SAMPLERS];
+    double sums[STREAM_SAMPLERS][3] = {{0}};
+    long counts[STREAM_SAMPLERS] = {0};
+    for(int s = 0; s < samplers; s++)
+        initSampler(&sampler[s], ctx->sequence, ctx->seed, stream, s);
+
+    streamEstimate e = {0};
+    double mean[3];
+    double error[3] = {INFINITY, INFINITY, INFINITY};
+    double delta_e = INFINITY;
+    bool converged = false;
+    long count = 0;
+
+    while(count < max_samples && !converged) {
+        const int s = count % samplers;
+        double value[3];
+        if(table) {
+            double pdf;
+            double wl = sampleImportance(table, getNextSample(&sampler[s]), &pdf);
+            double r = interpolateAtWl(r_func, wl) / pdf;
+            value[0] = r * interpolateAtWl(cmf->x, wl);
+            value[1] = r * interpolateAtWl(cmf->y, wl);
+            value[2] = r * interpolateAtWl(cmf->z, wl);
+        }
+        else {
+            int i = getNextGridIndex(&sampler[s], grid->count);
+            double r = lookupAtIndex(r_func, i) * grid->step * grid->count;
+            value[0] = r * lookupAtIndex(cmf->x, i);
+            value[1] = r * lookupAtIndex(cmf->y, i);
+            value[2] = r * lookupAtIndex(cmf->z, i);
+        }
+        if(samplers == 1) {
+            addStreamSample(&e, value);
+        } else {
+            for(int c = 0; c < 3; c++)
+                sums[s][c] += value[c];
+            counts[s]++;
+        }
+        count++;
+
+        if(count >= STREAM_SAMPLES_MIN && count % (STREAM_CHECK_INTERVAL * samplers) == 0) {
+            measureStream(&e, sums, counts, samplers, mean, error);
+            delta_e = estimateDeltaE(mean, error, white);
+            converged = (target_error > 0 && fmax(error[0], fmax(error[1], error[2])) <= target_error)
+                     || (target_delta_e > 0 && delta_e <= target_delta_e);
+        }
+    }
+
+    if(!converged) {
+        measureStream(&e, sums, counts, samplers, mean, error);
+        delta_e = estimateDeltaE(mean, error, white);
+    }
+
+    for(int c = 0; c < 3; c++) {
+        estimate->xyz[c] = mean[c];
+        estimate->standard_error[c] = error[c];
+    }
+    estimate->delta_e = delta_e;
+    estimate->num_samples = count;
+    estimate->converged = converged;
+
+    releaseWeightedCmf(cmf);
+    profileEnd(&scope, count);
+}
+
+// ========================================================
+// multithreading - thread pool with one task deque per
+// worker. A worker pops tasks from the tail of its own
+// deque and steals from the head of the others once its
+// own deque has run dry.
+// ========================================================
+typedef void (*taskFunction)(void *context, int index);
+
+typedef struct workerDeque {
+    int *tasks;
+    int head;
+    int tail;
+    pthread_mutex_t lock;
+} workerDeque;
+
+typedef struct threadPool {
+    int num_workers;
+    pthread_t *threads;
+    workerDeque *deques;
+
+    // current parallel loop
+    taskFunction task;
+    void *context;
+    int pending;
+    int generation;
+    bool shutdown;
+
+    pthread_mutex_t run_lock;   // one parallel loop at a time
+    pthread_mutex_t lock;
+    pthread_cond_t work_available;
+    pthread_cond_t work_done;
+} threadPool;
+
+typedef struct workerArgs {
+    threadPool *pool;
+    int id;
+} workerArgs;
+
+static int getNumberOfCores(void) {
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    return cores > 0 ? (int)cores : 1;
+}
+
+// take the newest task from the own deque
+static bool popTask(workerDeque *deque, int *index) {
+    bool found = false;
+    pthread_mutex_lock(&deque->lock);
+    if(deque->tail > deque->head) {
+        *index = deque->tasks[--deque->tail];
+        found = true;
+    }
+    pthread_mutex_unlock(&deque->lock);
+    return found;
+}
+
+// take the oldest task from another worker's deque
+static bool stealTask(workerDeque *deque, int *index) {
+    bool found = false;
+    pthread_mutex_lock(&deque->lock);
+    if(deque->tail > deque->head) {
+        *index = deque->tasks[deque->head++];
+        found = true;
+    }
+    pthread_mutex_unlock(&deque->lock);
+    return found;
+}
+
+static bool takeTask(threadPool *pool, const int id, int *index) {
+    if(popTask(&pool->deques[id], index))
+        return true;
+
+    for(int i = 1; i < pool->num_workers; i++) {
+        int victim = (id + i) % pool->num_workers;
+        if(stealTask(&pool->deques[victim], index))
+            return true;
+    }
+    return false;
+}
+
+static void *workerLoop(void *arg) {
+    workerArgs *args = (workerArgs *)arg;
+    threadPool *pool = args->pool;
+    const int id = args->id;
+    int seen_generation = 0;
+
+    while(1) {
+        pthread_mutex_lock(&pool->lock);
+        while(pool->generation == seen_generation && !pool->shutdown)
+            pthread_cond_wait(&pool->work_available, &pool->lock);
+        if(pool->shutdown) {
+            pthread_mutex_unlock(&pool->lock);
+            break;
+        }
+        seen_generation = pool->generation;
+        pthread_mutex_unlock(&pool->lock);
+
+        int index;
+        while(takeTask(pool, id, &index)) {
+            pool->task(pool->context, index);
+
+            pthread_mutex_lock(&pool->lock);
+            if(--pool->pending == 0)
+                pthread_cond_signal(&pool->work_done);
+            pthread_mutex_unlock(&pool->lock);
+        }
+    }
+
+    free(args);
+    return NULL;
+}
+
+static struct threadPool *createThreadPool(int num_workers) {
+    if(num_workers < 1)
+        num_workers = getNumberOfCores();
+
+    threadPool *pool = (struct threadPool *)calloc(1, sizeof(struct threadPool));
+    pool->num_workers = num_workers;
+    pool->threads = (pthread_t *)calloc(num_workers, sizeof(pthread_t));
+    pool->deques = (workerDeque *)calloc(num_workers, sizeof(workerDeque));
+    pthread_mutex_init(&pool->run_lock, NULL);
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->work_available, NULL);
+    pthread_cond_init(&pool->work_done, NULL);
+
+    for(int i = 0; i < num_workers; i++)
+        pthread_mutex_init(&pool->deques[i].lock, NULL);
+
+    for(int i = 0; i < num_workers; i++) {
+        workerArgs *args = (workerArgs *)malloc(sizeof(workerArgs));
+        args->pool = pool;
+        args->id = i;
+        pthread_create(&pool->threads[i], NULL, workerLoop, args);
+    }
+    return pool;
+}
+
+static void deleteThreadPool(struct threadPool *pool) {
+    pthread_mutex_lock(&pool->lock);
+    pool->shutdown = true;
+    pthread_cond_broadcast(&pool->work_available);
+    pthread_mutex_unlock(&pool->lock);
+
+    for(int i = 0; i < pool->num_workers; i++) {
+        pthread_join(pool->threads[i], NULL);
+        pthread_mutex_destroy(&pool->deques[i].lock);
+        free(pool->deques[i].tasks);
+    }
+    pthread_mutex_destroy(&pool->run_lock);
+    pthread_mutex_destroy(&pool->lock);
+    pthread_cond_destroy(&pool->work_available);
+    pthread_cond_destroy(&pool->work_done);
+    free(pool->deques);
+    free(pool->threads);
+    free(pool);
+}
+
+// call task(context, i) for every i in [0, count) and wait until all calls have returned.
+// indices are dealt out round-robin, so each call can store its result at position i and
+// the results stay in input order no matter which worker ran them. Loops of several
+// threads on the same pool run one after the other, a task must not start another loop.
+static void parallelFor(struct threadPool *pool, const int count, taskFunction task, void *context) {
+    if(count <= 0)
+        return;
+
+    pthread_mutex_lock(&pool->run_lock);
+    pthread_mutex_lock(&pool->lock);
+    pool->task = task;
+    pool->context = context;
+    pool->pending = count;
+
+    for(int w = 0; w < pool->num_workers; w++) {
+        workerDeque *deque = &pool->deques[w];
+        pthread_mutex_lock(&deque->lock);
+        free(deque->tasks);
+        deque->tasks = (int *)malloc((count / pool->num_workers + 1) * sizeof(int));
+        deque->head = 0;
+        deque->tail = 0;
+        // push in reverse, so the owner pops its tasks in ascending order
+        for(int i = count - 1; i >= 0; i--) {
+            if(i % pool->num_workers == w)
+                deque->tasks[deque->tail++] = i;
+        }
+        pthread_mutex_unlock(&deque->lock);
+    }
+
+    pool->generation++;
+    pthread_cond_broadcast(&pool->work_available);
+    while(pool->pending > 0)
+        pthread_cond_wait(&pool->work_done, &pool->lock);
+    pthread_mutex_unlock(&pool->lock);
+    pthread_mutex_unlock(&pool->run_lock);
+}
+
+// the pool of a context, started on first use with num_threads workers (0 = one per core)
+static struct threadPool *getContextPool(spectocolContext *ctx, const int num_threads) {
+    pthread_mutex_lock(&ctx->pool_lock);
+    if(ctx->pool == NULL)
+        ctx->pool = createThreadPool(num_threads);
+    threadPool *pool = ctx->pool;
+    pthread_mutex_unlock(&ctx->pool_lock);
+    return pool;
+}
+
+// ========================================================
+// image mode - render a hyperspectral reflectance cube
+// (ENVI header + raw float data, BSQ/BIL/BIP) to an sRGB
+// PPM or linear PFM under one luminaire.
+// The cube is streamed from disk in tiles of whole lines,
+// a window of tiles is converted by the thread pool and
+// written out before the next window is read.
+// ========================================================
+#define IMAGE_TILE_BYTES (1024 * 1024)
+#define IMAGE_TILES_PER_WORKER 4
+#define ENVI_KEY_MAX 64
+
+enum cubeInterleave {INTERLEAVE_BSQ, INTERLEAVE_BIL, INTERLEAVE_BIP};
+
+typedef struct hyperspectralCube {
+    int samples;        // pixels per line
+    int lines;
+    int bands;
+    int data_type;      // 4 = float, 5 = double
+    size_t value_size;
+    enum cubeInterleave interleave;
+    bool swap_bytes;
+    uint64_t header_offset;
+    double scale;       // reflectance scale factor
+    float *wavelength;  // per band, in nm
+    int fd;
+} hyperspectralCube;
+
+typedef struct imageJob {
+    hyperspectralCube *cube;
+    int used_bands;     // bands inside the visible range
+    int *band;          // cube band of every used band
+    double *x;          // per used band: trapezoid weight * l * cie / white
+    double *y;
+    double *z;
+    int tile_lines;
+    int first_tile;     // first tile of the current window
+    float *rgb;         // linear rgb of every pixel in the window
+    bool failed;        // set by any worker, only accessed atomically
+} imageJob;
+
+static char *getHeaderValue(char **cursor, char *key) {
+    char *line = *cursor;
+    char *equals = NULL;
+    char *p = line;
+    while(*p != '\0' && *p != '\n' && *p != '=')
+        p++;
+    if(*p != '=') {
+        *cursor = *p == '\n' ? p + 1 : p;
+        return NULL;
+    }
+    equals = p;
+
+    // value ends at the end of the line, or at the closing brace of a list
+    char *value = equals + 1;
+    while(*value == ' ' || *value == '\t')
+        value++;
+    char *end = value;
+    if(*value == '{') {
+        while(*end != '\0' && *end != '}')
+            end++;
+    }
+    else {
+        while(*end != '\0' && *end != '\n')
+            end++;
+    }
+    *cursor = *end == '\0' ? end : end + 1;
+    *end = '\0';
+
+    *equals = '\0';
+    snprintf(key, ENVI_KEY_MAX, "%s", trimWhitespace(line));
+    for(char *k = key; *k != '\0'; k++)
+        *k = (char)tolower((unsigned char)*k);
+    return *value == '{' ? value + 1 : trimWhitespace(value);
+}
+
+// read the list of band centres, converted to nm
+static bool parseWavelengths(hyperspectralCube *cube, char *list, const bool micrometers) {
+    cube->wavelength = (float *)malloc(cube->bands * sizeof(float));
+    const char *cursor = list;
+    const char *end = list + strlen(list);
+    for(int b = 0; b < cube->bands; b++) {
+        while(cursor < end && (isspace((unsigned char)*cursor) || *cursor == ','))
+            cursor++;
+        double wl;
+        if(!scanNumber(&cursor, end, &wl))
+            return false;
+        cube->wavelength[b] = (float)(micrometers ? wl * 1000.0 : wl);
+    }
+    return true;
+}
+
+// parse the ENVI header, returns false (and prints why) if the cube can not be rendered
+static bool readCubeHeader(const char *header_filename, hyperspectralCube *cube) {
+    size_t size;
+    char *buffer = readWholeFile(header_filename, &size);
+    if(buffer == NULL) {
+        printf("Header file %s not found...\n", header_filename);
+        return false;
+    }
+    if(strncmp(buffer, "ENVI", 4) != 0) {
+        printf("%s is not an ENVI header.\n", header_filename);
+        free(buffer);
+        return false;
+    }
+
+    memset(cube, 0, sizeof(hyperspectralCube));
+    cube->data_type = 4;
+    cube->scale = 1.0;
+    cube->fd = -1;
+    int byte_order = 0;
+    char *interleave = "bsq";
+    char *wavelengths = NULL;
+    bool micrometers = false;
+
+    char key[ENVI_KEY_MAX];
+    char *cursor = buffer + 4;
+    while(*cursor != '\0') {
+        char *value = getHeaderValue(&cursor, key);
+        if(value == NULL)
+            continue;
+        if(strcmp(key, "samples") == 0)
+            cube->samples = atoi(value);
+        else if(strcmp(key, "lines") == 0)
+            cube->lines = atoi(value);
+        else if(strcmp(key, "bands") == 0)
+            cube->bands = atoi(value);
+        else if(strcmp(key, "header offset") == 0)
+            cube->header_offset = strtoull(value, NULL, 10);
+        else if(strcmp(key, "data type") == 0)
+            cube->data_type = atoi(value);
+        else if(strcmp(key, "byte order") == 0)
+            byte_order = atoi(value);
+        else if(strcmp(key, "interleave") == 0)
+            interleave = value;
+        else if(strcmp(key, "reflectance scale factor") == 0)
+            cube->scale = atof(value);
+        else if(strcmp(key, "wavelength units") == 0)
+            micrometers = strncasecmp(value, "micro", 5) == 0 || strcasecmp(value, "um") == 0;
+        else if(strcmp(key, "wavelength") == 0)
+            wavelengths = value;
+    }
+
+    bool valid = false;
+    if(cube->samples < 1 || cube->lines < 1 || cube->bands < 1)
+        printf("%s: samples, lines and bands must be positive.\n", header_filename);
+    else if(cube->data_type != 4 && cube->data_type != 5)
+        printf("%s: data type %d is not supported, only 4 (float) and 5 (double).\n", header_filename, cube->data_type);
+    else if(strcasecmp(interleave, "bsq") != 0 && strcasecmp(interleave, "bil") != 0 && strcasecmp(interleave, "bip") != 0)
+        printf("%s: unknown interleave '%s'.\n", header_filename, interleave);
+    else if(cube->scale <= 0.0)
+        printf("%s: reflectance scale factor must be positive.\n", header_filename);
+    else if(wavelengths == NULL || !parseWavelengths(cube, wavelengths, micrometers))
+        printf("%s: needs a wavelength for each of the %d bands.\n", header_filename, cube->bands);
+    else
+        valid = true;
+
+    if(valid) {
+        cube->value_size = cube->data_type == 4 ? sizeof(float) : sizeof(double);
+        cube->swap_bytes = byte_order != (__BYTE_ORDER__ == __ORDER_BIG_ENDIAN__);
+        if(strcasecmp(interleave, "bil") == 0)
+            cube->interleave = INTERLEAVE_BIL;
+        else if(strcasecmp(interleave, "bip") == 0)
+            cube->interleave = INTERLEAVE_BIP;
+        else
+            cube->interleave = INTERLEAVE_BSQ;
+    }
+    free(buffer);
+    return valid;
+}
+
+// the data file sits next to the header: same name without .hdr, or with a raw data extension
+static bool openCubeData(const char *header_filename, hyperspectralCube *cube) {
+    const char *extensions[] = {"", ".raw", ".img", ".dat", ".bsq", ".bil", ".bip"};
+    size_t base_length = strlen(header_filename);
+    if(base_length > 4 && strcasecmp(header_filename + base_length - 4, ".hdr") == 0)
+        base_length -= 4;
+
+    char *data_filename = (char *)malloc(base_length + 8);
+    for(size_t i = 0; i < sizeof(extensions) / sizeof(extensions[0]) && cube->fd < 0; i++) {
+        snprintf(data_filename, base_length + 8, "%.*s%s", (int)base_length, header_filename, extensions[i]);
+        if(strcmp(data_filename, header_filename) != 0)
+            cube->fd = open(data_filename, O_RDONLY);
+    }
+    if(cube->fd < 0) {
+        printf("No data file found for %s.\n", header_filename);
+        free(data_filename);
+        return false;
+    }
+
+    struct stat info;
+    uint64_t expected = cube->header_offset + (uint64_t)cube->samples * cube->lines * cube->bands * cube->value_size;
+    bool valid = fstat(cube->fd, &info) == 0 && (uint64_t)info.st_size >= expected;
+    if(!valid)
+        printf("%s is too short for %d x %d x %d values.\n", data_filename, cube->samples, cube->lines, cube->bands);
+    free(data_filename);
+    return valid;
+}
+
+static void closeCube(hyperspectralCube *cube) {
+    if(cube->fd >= 0)
+        close(cube->fd);
+    free(cube->wavelength);
+}
+
+// read size bytes at offset, pread may return less than asked for
+static bool readCubeBytes(const hyperspectralCube *cube, char *buffer, size_t size, uint64_t offset) {
+    while(size > 0) {
+        ssize_t got = pread(cube->fd, buffer, size, (off_t)offset);
+        if(got <= 0)
+            return false;
+        buffer += got;
+        size -= got;
+        offset += got;
+    }
+    return true;
+}
+
+// convert count raw values to doubles, the buffer must hold count doubles
+static void decodeCubeValues(const hyperspectralCube *cube, char *raw, double *values, const size_t count) {
+    if(cube->swap_bytes) {
+        for(size_t i = 0; i < count * cube->value_size; i += cube->value_size) {
+            for(size_t j = 0; j < cube->value_size / 2; j++) {
+                char t = raw[i + j];
+                raw[i + j] = raw[i + cube->value_size - 1 - j];
+                raw[i + cube->value_size - 1 - j] = t;
+            }
+        }
+    }
+    // decode backwards, raw and values may share memory
+    if(cube->data_type == 4) {
+        for(size_t i = count; i-- > 0;) {
+            float v;
+            memcpy(&v, raw + i * sizeof(float), sizeof(float));
+            values[i] = v;
+        }
+    }
+    else if(raw != (char *)values) {
+        memcpy(values, raw, count * sizeof(double));
+    }
+}
+
+// task for the thread pool: read tile first_tile + index and convert its pixels
+static void renderImageTile(void *context, int index) {
+    imageJob *job = (imageJob *)context;
+    hyperspectralCube *cube = job->cube;
+    const int tile = job->first_tile + index;
+    const int first_line = tile * job->tile_lines;
+    if(first_line >= cube->lines)
+        return;
+    int lines = cube->lines - first_line;
+    if(lines > job->tile_lines)
+        lines = job->tile_lines;
+
+    profileScope scope = profileBegin(PROFILE_IMAGE_TILE);
+    arena *a = getThreadArena();
+    arenaMark mark = arenaSave(a);
+
+    // bsq only needs the used bands, bil and bip are read in one piece
+    const size_t line_values = (size_t)cube->samples * lines;
+    const int read_bands = cube->interleave == INTERLEAVE_BSQ ? job->used_bands : cube->bands;
+    const size_t count = line_values * read_bands;
+    double *values = (double *)arenaAlloc(a, count * sizeof(double));
+    bool ok = true;
+
+    if(cube->interleave == INTERLEAVE_BSQ) {
+        for(int j = 0; j < job->used_bands && ok; j++) {
+            uint64_t offset = cube->header_offset
+                    + ((uint64_t)job->band[j] * cube->lines + first_line) * cube->samples * cube->value_size;
+            ok = readCubeBytes(cube, (char *)(values + j * line_values), line_values * cube->value_size, offset);
+        }
+    }
+    else {
+        uint64_t offset = cube->header_offset + (uint64_t)first_line * cube->samples * cube->bands * cube->value_size;
+        ok = readCubeBytes(cube, (char *)values, count * cube->value_size, offset);
+    }
+
+    float *rgb = job->rgb + (size_t)index * job->tile_lines * cube->samples * 3;
+    if(!ok) {
+        __atomic_store_n(&job->failed, true, __ATOMIC_RELAXED);
+        memset(rgb, 0, line_values * 3 * sizeof(float));
+        arenaRestore(a, mark);
+        profileEnd(&scope, 0);
+        return;
+    }
+
+    if(cube->interleave == INTERLEAVE_BSQ) {
+        for(int j = 0; j < job->used_bands; j++)
+            decodeCubeValues(cube, (char *)(values + j * line_values), values + j * line_values, line_values);
+    }
+    else {
+        decodeCubeValues(cube, (char *)values, values, count);
+    }
+
+    double *pixel = (double *)arenaAlloc(a, job->used_bands * sizeof(double));
+    for(int line = 0; line < lines; line++) {
+        for(int s = 0; s < cube->samples; s++) {
+            for(int j = 0; j < job->used_bands; j++) {
+                size_t i;
+                if(cube->interleave == INTERLEAVE_BSQ)
+                    i = j * line_values + (size_t)line * cube->samples + s;
+                else if(cube->interleave == INTERLEAVE_BIL)
+                    i = ((size_t)line * cube->bands + job->band[j]) * cube->samples + s;
+                else
+                    i = ((size_t)line * cube->samples + s) * cube->bands + job->band[j];
+                pixel[j] = values[i];
+            }
+
+            double xyz[3];
+            dotXyz(pixel, job->x, job->y, job->z, job->used_bands, xyz);
+            float cie[3] = {xyz[0], xyz[1], xyz[2]};
+            convertToRgb(cie, rgb + ((size_t)line * cube->samples + s) * 3);
+        }
+    }
+    arenaRestore(a, mark);
+    profileEnd(&scope, line_values);
+}
+
+// per band weights, so that a pixel's xyz is a dot product with its reflectance and
+// a perfect white reflector has Y = 1
+static bool createImageWeights(spectocolContext *ctx, imageJob *job, const spectrum *luminaire) {
+    hyperspectralCube *cube = job->cube;
+
+    const spectralGrid *grid = &ctx->registry.grid;
+    job->band = (int *)malloc(cube->bands * sizeof(int));
+    float *wl = (float *)malloc(cube->bands * sizeof(float));
+    job->used_bands = 0;
+    for(int b = 0; b < cube->bands; b++) {
+        if(cube->wavelength[b] >= grid->lower && cube->wavelength[b] <= grid->upper) {
+            if(job->used_bands > 0 && cube->wavelength[b] <= wl[job->used_bands - 1]) {
+                printf("Band wavelengths must be increasing.\n");
+                free(wl);
+                return false;
+            }
+            job->band[job->used_bands] = b;
+            wl[job->used_bands++] = cube->wavelength[b];
+        }
+    }
+    if(job->used_bands < 2) {
+        printf("The cube needs at least two bands between %g and %g nm.\n", grid->lower, grid->upper);
+        free(wl);
+        return false;
+    }
+
+    weightedCmf *cmf = getWeightedCmf(ctx, luminaire);
+
+    job->x = (double *)allocAligned(job->used_bands * sizeof(double));
+    job->y = (double *)allocAligned(job->used_bands * sizeof(double));
+    job->z = (double *)allocAligned(job->used_bands * sizeof(double));
+    double *weights = (double *)allocAligned(job->used_bands * sizeof(double));
+    trapezoidWeightsNonuniform(weights, wl, job->used_bands);
+
+    double white = 0.0;
+    for(int j = 0; j < job->used_bands; j++) {
+        job->x[j] = weights[j] * interpolateAtWl(cmf->x, wl[j]);
+        job->y[j] = weights[j] * interpolateAtWl(cmf->y, wl[j]);
+        job->z[j] = weights[j] * interpolateAtWl(cmf->z, wl[j]);
+        white += job->y[j];
+    }
+    for(int j = 0; j < job->used_bands; j++) {
+        job->x[j] /= white * cube->scale;
+        job->y[j] /= white * cube->scale;
+        job->z[j] /= white * cube->scale;
+    }
+
+    releaseWeightedCmf(cmf);
+    free(weights);
+    free(wl);
+    return white > 0.0;
+}
+
+static unsigned char encodeSrgb(float linear) {
+    if(!(linear > 0.0f))
+        return 0;
+    if(linear >= 1.0f)
+        return 255;
+    float v = linear <= 0.0031308f ? 12.92f * linear : 1.055f * powf(linear, 1.0f / 2.4f) - 0.055f;
+    return (unsigned char)lroundf(v * 255.0f);
+}
+
+// write lines [first_line, first_line + lines) of the image
+// ppm is stored top down as 8 bit srgb, pfm bottom up as linear little endian floats
+static bool writeImageLines(FILE *image, const bool pfm, const long header_size, const int width, const int height,
+                            const int first_line, const int lines, const float *rgb, unsigned char *row) {
+    const size_t row_size = (size_t)width * 3 * (pfm ? sizeof(float) : 1);
+    for(int line = 0; line < lines; line++) {
+        const float *src = rgb + (size_t)line * width * 3;
+        int y = first_line + line;
+        if(pfm) {
+            memcpy(row, src, row_size);
+            y = height - 1 - y;
+        }
+        else {
+            for(int i = 0; i < width * 3; i++)
+                row[i] = encodeSrgb(src[i]);
+        }
+        if(fseeko(image, header_size + (off_t)y * row_size, SEEK_SET) != 0 || fwrite(row, 1, row_size, image) != row_size)
+            return false;
+    }
+    return true;
+}
+
+static bool renderHyperspectralImage(spectocolContext *ctx, const char *header_filename, const char *output_filename,
+                                     const spectrum *luminaire, const int num_threads) {
+    hyperspectralCube cube;
+    if(!readCubeHeader(header_filename, &cube))
+        return false;
+
+    imageJob job;
+    memset(&job, 0, sizeof(job));
+    job.cube = &cube;
+    if(!openCubeData(header_filename, &cube) || !createImageWeights(ctx, &job, luminaire)) {
+        free(job.band);
+        free(job.x);
+        free(job.y);
+        free(job.z);
+        closeCube(&cube);
+        return false;
+    }
+
+    bool rendered = false;
+    size_t ext = strlen(output_filename);
+    bool pfm = ext > 4 && strcasecmp(output_filename + ext - 4, ".pfm") == 0;
+    FILE *image = fopen(output_filename, "wb");
+    if(image == NULL) {
+        printf("Image file %s could not be created.\n", output_filename);
+    }
+    else {
+        if(pfm)
+            fprintf(image, "PF\n%d %d\n%s\n", cube.samples, cube.lines,
+                    __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__ ? "1.0" : "-1.0");
+        else
+            fprintf(image, "P6\n%d %d\n255\n", cube.samples, cube.lines);
+        long header_size = ftell(image);
+
+        size_t line_bytes = (size_t)cube.samples * cube.bands * cube.value_size;
+        job.tile_lines = line_bytes >= IMAGE_TILE_BYTES ? 1 : (int)(IMAGE_TILE_BYTES / line_bytes);
+        if(job.tile_lines > cube.lines)
+            job.tile_lines = cube.lines;
+        int tile_count = (cube.lines + job.tile_lines - 1) / job.tile_lines;
+
+        threadPool *pool = getContextPool(ctx, num_threads);
+        int window_tiles = pool->num_workers * IMAGE_TILES_PER_WORKER;
+        job.rgb = (float *)allocAligned((size_t)window_tiles * job.tile_lines * cube.samples * 3 * sizeof(float));
+        unsigned char *row = (unsigned char *)malloc((size_t)cube.samples * 3 * sizeof(float));
+
+        bool written = true;
+        bool failed = false;
+        for(job.first_tile = 0; job.first_tile < tile_count && written && !failed; job.first_tile += window_tiles) {
+            int tiles = tile_count - job.first_tile < window_tiles ? tile_count - job.first_tile : window_tiles;
+            parallelFor(pool, tiles, renderImageTile, &job);
+            failed = __atomic_load_n(&job.failed, __ATOMIC_RELAXED);
+
+            int first_line = job.first_tile * job.tile_lines;
+            int lines = cube.lines - first_line < tiles * job.tile_lines ? cube.lines - first_line : tiles * job.tile_lines;
+            written = writeImageLines(image, pfm, header_size, cube.samples, cube.lines, first_line, lines, job.rgb, row);
+        }
+
+        if(fclose(image) != 0)
+            written = false;
+        if(failed)
+            printf("Reading the cube data of %s failed.\n", header_filename);
+        else if(!written)
+            printf("Writing %s failed.\n", output_filename);
+        rendered = written && !failed;
+
+        free(row);
+        free(job.rgb);
+    }
+
+    free(job.band);
+    free(job.x);
+    free(job.y);
+    free(job.z);
+    closeCube(&cube);
+    return rendered;
+}
+
+// ========================================================
+// all pairs - every reflectance under every luminaire with
+// fixed sampling as one matrix product. The samples of the
+// reflectances are the rows of A (n x k), the weighted cmfs
+// of the luminaires at the same wavelengths are the columns
+// of B (k x 3m), so row i of A B holds the xyz of the i-th
+// reflectance under every luminaire. Each task multiplies
+// a block of rows: B is walked in panels that stay in the
+// L2 cache and every 6 x 8 tile of the product is summed
+// in registers over all of k
+// ========================================================
+#define GEMM_TILE_ROWS 6
+#define GEMM_TILE_COLUMNS 8
+#define GEMM_PANEL_COLUMNS 256     // k x 256 doubles of B, 100 KiB for 50 samples
+#define GEMM_BLOCK_ROWS 96         // reflectances per task, a multiple of GEMM_TILE_ROWS
+
+typedef struct allPairsJob {
+    int rows;                       // reflectances
+    int luminaires;
+    int depth;                      // samples per spectrum
+    int stride;                     // grid steps between two samples
+    int ldb;                        // 3 * luminaires, padded to GEMM_TILE_COLUMNS
+    const spectrum **reflectances;
+    double *b;                      // depth x ldb, zero in the padding
+    float *xyz;                     // per reflectance and luminaire, either may be NULL
+    float *rgb;
+} allPairsJob;
+
+// c = a b for one tile: a is packed k-major (depth x GEMM_TILE_ROWS),
+// b and c are row-major with ldb and ldc doubles per row
+typedef void (*gemmKernel)(const double *a, const double *b, int ldb, int depth, double *c, int ldc);
+
+static void gemmTileScalar(const double *a, const double *b, int ldb, int depth, double *c, int ldc) {
+    double sum[GEMM_TILE_ROWS][GEMM_TILE_COLUMNS];
+    memset(sum, 0, sizeof(sum));
+    for(int k = 0; k < depth; k++) {
+        for(int r = 0; r < GEMM_TILE_ROWS; r++) {
+            for(int j = 0; j < GEMM_TILE_COLUMNS; j++)
+                sum[r][j] += a[k * GEMM_TILE_ROWS + r] * b[k * ldb + j];
+        }
+    }
+    for(int r = 0; r < GEMM_TILE_ROWS; r++)
+        memcpy(c + r * ldc, sum[r], sizeof(sum[r]));
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+// two registers per row, 12 accumulators
+static __attribute__((target("avx2,fma")))
+void gemmTileAvx2(const double *a, const double *b, int ldb, int depth, double *c, int ldc) {
+    __m256d c00 = _mm256_setzero_pd(), c01 = _mm256_setzero_pd();
+    __m256d c10 = _mm256_setzero_pd(), c11 = _mm256_setzero_pd();
+    __m256d c20 = _mm256_setzero_pd(), c21 = _mm256_setzero_pd();
+    __m256d c30 = _mm256_setzero_pd(), c31 = _mm256_setzero_pd();
+    __m256d c40 = _mm256_setzero_pd(), c41 = _mm256_setzero_pd();
+    __m256d c50 = _mm256_setzero_pd(), c51 = _mm256_setzero_pd();
+
+    for(int k = 0; k < depth; k++) {
+        const double *ak = a + k * GEMM_TILE_ROWS;
+        __m256d b0 = _mm256_loadu_pd(b + k * ldb);
+        __m256d b1 = _mm256_loadu_pd(b + k * ldb + 4);
+        __m256d ai = _mm256_broadcast_sd(ak);
+        c00 = _mm256_fmadd_pd(ai, b0, c00);
+        c01 = _mm256_fmadd_pd(ai, b1, c01);
+        ai = _mm256_broadcast_sd(ak + 1);
+        c10 = _mm256_fmadd_pd(ai, b0, c10);
+        c11 = _mm256_fmadd_pd(ai, b1, c11);
+        ai = _mm256_broadcast_sd(ak + 2);
+        c20 = _mm256_fmadd_pd(ai, b0, c20);
+        c21 = _mm256_fmadd_pd(ai, b1, c21);
+        ai = _mm256_broadcast_sd(ak + 3);
+        c30 = _mm256_fmadd_pd(ai, b0, c30);
+        c31 = _mm256_fmadd_pd(ai, b1, c31);
+        ai = _mm256_broadcast_sd(ak + 4);
+        c40 = _mm256_fmadd_pd(ai, b0, c40);
+        c41 = _mm256_fmadd_pd(ai, b1, c41);
+        ai = _mm256_broadcast_sd(ak + 5);
+        c50 = _mm256_fmadd_pd(ai, b0, c50);
+        c51 = _mm256_fmadd_pd(ai, b1, c51);
+    }
+
+    _mm256_storeu_pd(c, c00);
+    _mm256_storeu_pd(c + 4, c01);
+    _mm256_storeu_pd(c + ldc, c10);
+    _mm256_storeu_pd(c + ldc + 4, c11);
+    _mm256_storeu_pd(c + 2 * ldc, c20);
+    _mm256_storeu_pd(c + 2 * ldc + 4, c21);
+    _mm256_storeu_pd(c + 3 * ldc, c30);
+    _mm256_storeu_pd(c + 3 * ldc + 4, c31);
+    _mm256_storeu_pd(c + 4 * ldc, c40);
+    _mm256_storeu_pd(c + 4 * ldc + 4, c41);
+    _mm256_storeu_pd(c + 5 * ldc, c50);
+    _mm256_storeu_pd(c + 5 * ldc + 4, c51);
+}
+
+// one register per row
+static __attribute__((target("avx512f")))
+void gemmTileAvx512(const double *a, const double *b, int ldb, int depth, double *c, int ldc) {
+    __m512d c0 = _mm512_setzero_pd();
+    __m512d c1 = _mm512_setzero_pd();
+    __m512d c2 = _mm512_setzero_pd();
+    __m512d c3 = _mm512_setzero_pd();
+    __m512d c4 = _mm512_setzero_pd();
+    __m512d c5 = _mm512_setzero_pd();
+
+    for(int k = 0; k < depth; k++) {
+        const double *ak = a + k * GEMM_TILE_ROWS;
+        __m512d bk = _mm512_loadu_pd(b + k * ldb);
+        c0 = _mm512_fmadd_pd(_mm512_set1_pd(ak[0]), bk, c0);
+        c1 = _mm512_fmadd_pd(_mm512_set1_pd(ak[1]), bk, c1);
+        c2 = _mm512_fmadd_pd(_mm512_set1_pd(ak[2]), bk, c2);
+        c3 = _mm512_fmadd_pd(_mm512_set1_pd(ak[3]), bk, c3);
+        c4 = _mm512_fmadd_pd(_mm512_set1_pd(ak[4]), bk, c4);
+        c5 = _mm512_fmadd_pd(_mm512_set1_pd(ak[5]), bk, c5);
+    }
+
+    _mm512_storeu_pd(c, c0);
+    _mm512_storeu_pd(c + ldc, c1);
+    _mm512_storeu_pd(c + 2 * ldc, c2);
+    _mm512_storeu_pd(c + 3 * ldc, c3);
+    _mm512_storeu_pd(c + 4 * ldc, c4);
+    _mm512_storeu_pd(c + 5 * ldc, c5);
+}
+#endif
+
+static gemmKernel gemm_kernel = gemmTileScalar;
+static pthread_once_t gemm_kernel_once = PTHREAD_ONCE_INIT;
+
+static void selectGemmKernel(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("avx512f"))
+        gemm_kernel = gemmTileAvx512;
+    else if(__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+        gemm_kernel = gemmTileAvx2;
+#endif
+}
+
+// B: the fixed weighted cmfs of luminaire m in columns 3m, 3m + 1 and 3m + 2
+static double *createAllPairsMatrix(spectocolContext *ctx, const spectrum **luminaires, const int luminaire_count,
+                                    const int num_samples, const int ldb) {
+    double *b = (double *)allocAligned((size_t)num_samples * ldb * sizeof(double));
+    memset(b, 0, (size_t)num_samples * ldb * sizeof(double));
+    for(int m = 0; m < luminaire_count; m++) {
+        weightedCmf *weighted = getWeightedCmf(ctx, luminaires[m]);
+        double **cmf = getFixedWeightedCmf(ctx, weighted, num_samples);
+        for(int k = 0; k < num_samples; k++) {
+            for(int c = 0; c < 3; c++)
+                b[(size_t)k * ldb + 3 * m + c] = cmf[c][k];
+        }
+        releaseWeightedCmf(weighted);
+    }
+    return b;
+}
+
+// task for the thread pool: the xyz and rgb of the reflectances of block index under every luminaire
+static void convertPairBlock(void *context, int index) {
+    allPairsJob *job = (allPairsJob *)context;
+    const int first = index * GEMM_BLOCK_ROWS;
+    const int rows = job->rows - first < GEMM_BLOCK_ROWS ? job->rows - first : GEMM_BLOCK_ROWS;
+    const int tiles = (rows + GEMM_TILE_ROWS - 1) / GEMM_TILE_ROWS;
+
+    profileScope scope = profileBegin(PROFILE_ALL_PAIRS);
+    pthread_once(&gemm_kernel_once, selectGemmKernel);
+    arena *a = getThreadArena();
+    arenaMark mark = arenaSave(a);
+
+    // A, packed tile by tile so the kernel reads it in order, missing rows are 0
+    double *packed = (double *)arenaAlloc(a, (size_t)tiles * job->depth * GEMM_TILE_ROWS * sizeof(double));
+    for(int t = 0; t < tiles; t++) {
+        double *tile = packed + (size_t)t * job->depth * GEMM_TILE_ROWS;
+        for(int r = 0; r < GEMM_TILE_ROWS; r++) {
+            const int row = t * GEMM_TILE_ROWS + r;
+            for(int k = 0; k < job->depth; k++)
+                tile[k * GEMM_TILE_ROWS + r] = row < rows
+                        ? lookupAtIndex(job->reflectances[first + row], k * job->stride) : 0.0;
+        }
+    }
+
+    double *product = (double *)arenaAlloc(a, (size_t)tiles * GEMM_TILE_ROWS * job->ldb * sizeof(double));
+    for(int panel = 0; panel < job->ldb; panel += GEMM_PANEL_COLUMNS) {
+        const int panel_end = panel + GEMM_PANEL_COLUMNS < job->ldb ? panel + GEMM_PANEL_COLUMNS : job->ldb;
+        for(int t = 0; t < tiles; t++) {
+            for(int j = panel; j < panel_end; j += GEMM_TILE_COLUMNS)
+                gemm_kernel(packed + (size_t)t * job->depth * GEMM_TILE_ROWS, job->b + j, job->ldb, job->depth,
+                            product + (size_t)t * GEMM_TILE_ROWS * job->ldb + j, job->ldb);
+        }
+    }
+
+    for(int r = 0; r < rows; r++) {
+        for(int m = 0; m < job->luminaires; m++) {
+            const double *xyz = product + (size_t)r * job->ldb + 3 * m;
+            const size_t out = ((size_t)(first + r) * job->luminaires + m) * 3;
+            float cie[3] = {xyz[0], xyz[1], xyz[2]};
+            if(job->xyz)
+                memcpy(job->xyz + out, cie, sizeof(cie));
+            if(job->rgb)
+                convertToRgb(cie, job->rgb + out);
+        }
+    }
+    arenaRestore(a, mark);
+    profileEnd(&scope, (long)rows * job->luminaires);
+}
+
+static void convertAllPairs(spectocolContext *ctx, const int num_samples, const spectrum **luminaires,
+                            const int luminaire_count, const spectrum **reflectances, const int reflectance_count,
+                            float *xyz, float *rgb, const int num_threads) {
+    allPairsJob job;
+    job.rows = reflectance_count;
+    job.luminaires = luminaire_count;
+    job.depth = num_samples;
+    job.stride = getFixedStride(&ctx->registry.grid, num_samples);
+    job.ldb = (3 * luminaire_count + GEMM_TILE_COLUMNS - 1) / GEMM_TILE_COLUMNS * GEMM_TILE_COLUMNS;
+    job.reflectances = reflectances;
+    job.b = createAllPairsMatrix(ctx, luminaires, luminaire_count, num_samples, job.ldb);
+    job.xyz = xyz;
+    job.rgb = rgb;
+
+    const int blocks = (reflectance_count + GEMM_BLOCK_ROWS - 1) / GEMM_BLOCK_ROWS;
+    parallelFor(getContextPool(ctx, num_threads), blocks, convertPairBlock, &job);
+    free(job.b);
+}
+
+// ========================================================
+// rgb upsampling - the inverse of a conversion, after Jakob
+// and Hanika 2019. A reflectance sigmoid(c0 wl^2 + c1 wl
+// + c2) is fitted once to every point of a grid over the
+// linear srgb cube, in CIELAB under a luminaire. The cube
+// is split by its largest component: a table point is that
+// component (on a scale that is finer near 0 and 1) and
+// the other two relative to it. Upsampling a colour is a
+// trilinear interpolation of the coefficients around it
+// ========================================================
+#define UPSAMPLING_MAGIC "SPECUPS"
+#define UPSAMPLING_VERSION 1
+#define UPSAMPLING_ITERATIONS 15
+#define UPSAMPLING_HALVINGS 8
+#define UPSAMPLING_COEFFICIENT_MAX 200.0    // of the normalised polynomial, keeps the fit well conditioned
+#define UPSAMPLING_JACOBIAN_STEP 1e-5
+#define UPSAMPLING_FIT_STEP 5.0             // nm between the wavelengths the fit is evaluated at
+#define UPSAMPLING_GREY_MIN 1e-8            // greys are solved in closed form, 0 and 1 are moved inside
+
+struct spectocolUpsamplingTable {
+    int resolution;
+    float *scale;           // values of the largest component, increasing from 0 to 1
+    float *coefficients;    // c0, c1, c2 for wl in nm, indexed [largest][scale][second][first]
+};
+
+typedef struct upsamplingHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t resolution;
+    char reserved[16];
+} upsamplingHeader;
+
+// weights of the fit: xyz of a reflectance is its dot product with them, the white has Y = 1
+typedef struct upsamplingFit {
+    int count;
+    double *wavelength;     // normalised to [0, 1] over the grid
+    double *x;
+    double *y;
+    double *z;
+    double white[3];
+    double rgb_to_xyz[3][3];
+    float lower;            // of the grid, to convert the coefficients to nm
+    float range;
+    spectocolUpsamplingTable *table;
+} upsamplingFit;
+
+static double sigmoid(const double x) {
+    return 0.5 + x / (2 * sqrt(1 + x * x));
+}
+
+static double smoothstep(const double x) {
+    return x * x * (3 - 2 * x);
+}
+
+// solve a x = b by gaussian elimination with partial pivoting, false if a is singular
+static bool solve3x3(double a[3][3], double b[3], double x[3]) {
+    for(int c = 0; c < 3; c++) {
+        int pivot = c;
+        for(int r = c + 1; r < 3; r++) {
+            if(fabs(a[r][c]) > fabs(a[pivot][c]))
+                pivot = r;
+        }
+        if(fabs(a[pivot][c]) < 1e-15)
+            return false;
+        for(int k = 0; k < 3; k++) {
+            double t = a[c][k];
+            a[c][k] = a[pivot][k];
+            a[pivot][k] = t;
+        }
+        double t = b[c];
+        b[c] = b[pivot];
+        b[pivot] = t;
+
+        for(int r = c + 1; r < 3; r++) {
+            double f = a[r][c] / a[c][c];
+            for(int k = c; k < 3; k++)
+                a[r][k] -= f * a[c][k];
+            b[r] -= f * b[c];
+        }
+    }
+    for(int r = 2; r >= 0; r--) {
+        double sum = b[r];
+        for(int k = r + 1; k < 3; k++)
+            sum -= a[r][k] * x[k];
+        x[r] = sum / a[r][r];
+    }
+    return true;
+}
+
+// CIELAB of the reflectance with coefficients c over the normalised wavelengths
+static void fitToLab(const upsamplingFit *fit, const double c[3], double lab[3]) {
+    double xyz[3] = {0, 0, 0};
+    for(int i = 0; i < fit->count; i++) {
+        double wl = fit->wavelength[i];
+        double s = sigmoid((c[0] * wl + c[1]) * wl + c[2]);
+        xyz[0] += s * fit->x[i];
+        xyz[1] += s * fit->y[i];
+        xyz[2] += s * fit->z[i];
+    }
+    xyzToLab(xyz, fit->white, lab);
+}
+
+// squared CIELAB distance of the reflectance with coefficients c to target, lab is its CIELAB
+static double fitError(const upsamplingFit *fit, const double c[3], const double target[3], double lab[3]) {
+    fitToLab(fit, c, lab);
+    double error = 0;
+    for(int k = 0; k < 3; k++)
+        error += (lab[k] - target[k]) * (lab[k] - target[k]);
+    return error;
+}
+
+// gauss-newton on the CIELAB distance to rgb, c is the start and the result. Near the border of the
+// object colours the full step overshoots, so it is halved until the distance decreases
+static void fitCoefficients(const upsamplingFit *fit, const double rgb[3], double c[3]) {
+    double xyz[3], target[3];
+    for(int r = 0; r < 3; r++)
+        xyz[r] = fit->rgb_to_xyz[r][0] * rgb[0] + fit->rgb_to_xyz[r][1] * rgb[1] + fit->rgb_to_xyz[r][2] * rgb[2];
+    xyzToLab(xyz, fit->white, target);
+
+    double lab[3];
+    double error = fitError(fit, c, target, lab);
+    for(int iteration = 0; iteration < UPSAMPLING_ITERATIONS && error > 1e-6; iteration++) {
+        double residual[3];
+        for(int k = 0; k < 3; k++)
+            residual[k] = lab[k] - target[k];
+
+        // forward differences
+        double jacobian[3][3];
+        for(int j = 0; j < 3; j++) {
+            double moved[3] = {c[0], c[1], c[2]};
+            moved[j] += UPSAMPLING_JACOBIAN_STEP;
+            double moved_lab[3];
+            fitToLab(fit, moved, moved_lab);
+            for(int k = 0; k < 3; k++)
+                jacobian[k][j] = (moved_lab[k] - lab[k]) / UPSAMPLING_JACOBIAN_STEP;
+        }
+
+        double step[3];
+        if(!solve3x3(jacobian, residual, step))
+            break;
+
+        bool improved = false;
+        for(int halving = 0; halving < UPSAMPLING_HALVINGS && !improved; halving++) {
+            double moved[3], largest = 0;
+            for(int j = 0; j < 3; j++) {
+                moved[j] = c[j] - step[j];
+                largest = fmax(largest, fabs(moved[j]));
+            }
+            if(largest > UPSAMPLING_COEFFICIENT_MAX) {
+                for(int j = 0; j < 3; j++)
+                    moved[j] *= UPSAMPLING_COEFFICIENT_MAX / largest;
+            }
+            double moved_lab[3];
+            double moved_error = fitError(fit, moved, target, moved_lab);
+            if(moved_error < error) {
+                memcpy(c, moved, sizeof(moved));
+                memcpy(lab, moved_lab, sizeof(moved_lab));
+                error = moved_error;
+                improved = true;
+            }
+            for(int j = 0; j < 3; j++)
+                step[j] *= 0.5;
+        }
+        if(!improved)
+            break;
+    }
+}
+
+// fit the coefficients of table point k, i, j from the start c and store them in nm
+static void fitUpsamplingPoint(const upsamplingFit *fit, const int largest, const int k, const int j, const int i,
+                               double c[3]) {
+    spectocolUpsamplingTable *table = fit->table;
+    const int res = table->resolution;
+    double rgb[3];
+    rgb[largest] = table->scale[k];
+    rgb[(largest + 1) % 3] = table->scale[k] * i / (res - 1);
+    rgb[(largest + 2) % 3] = table->scale[k] * j / (res - 1);
+    fitCoefficients(fit, rgb, c);
+
+    // from the normalised wavelength (wl - lower) / range to wl in nm
+    float *out = &table->coefficients[3 * ((((size_t)largest * res + k) * res + j) * res + i)];
+    double a = 1.0 / fit->range;
+    double b = -fit->lower / fit->range;
+    out[0] = c[0] * a * a;
+    out[1] = 2 * c[0] * a * b + c[1] * a;
+    out[2] = (c[0] * b + c[1]) * b + c[2];
+}
+
+// task for the thread pool: one row of the table, index = largest component * resolution + second.
+// Along the scale every fit starts from the previous one, going up and down from a fifth
+static void fitUpsamplingRow(void *context, int index) {
+    const upsamplingFit *fit = (const upsamplingFit *)context;
+    const int res = fit->table->resolution;
+    const int largest = index / res;
+    const int j = index % res;
+    const int start = res / 5;
+
+    for(int i = 0; i < res; i++) {
+        double first[3] = {0, 0, 0};
+        fitUpsamplingPoint(fit, largest, start, j, i, first);
+
+        double c[3] = {first[0], first[1], first[2]};
+        for(int k = start + 1; k < res; k++)
+            fitUpsamplingPoint(fit, largest, k, j, i, c);
+        memcpy(c, first, sizeof(first));
+        for(int k = start - 1; k >= 0; k--)
+            fitUpsamplingPoint(fit, largest, k, j, i, c);
+    }
+}
+
+static spectocolUpsamplingTable *createUpsamplingTable(const int resolution) {
+    spectocolUpsamplingTable *table = (spectocolUpsamplingTable *)malloc(sizeof(spectocolUpsamplingTable));
+    table->resolution = resolution;
+    table->scale = (float *)malloc(resolution * sizeof(float));
+    table->coefficients = (float *)allocAligned(9 * (size_t)resolution * resolution * resolution * sizeof(float));
+    return table;
+}
+
+static void deleteUpsamplingTable(spectocolUpsamplingTable *table) {
+    if(!table)
+        return;
+    free(table->scale);
+    free(table->coefficients);
+    free(table);
+}
+
+static spectocolUpsamplingTable *fitUpsamplingTable(spectocolContext *ctx, const spectrum *luminaire,
+                                                    const int resolution, const int num_threads) {
+    const spectralGrid *grid = &ctx->registry.grid;
+    const int stride = grid->step >= UPSAMPLING_FIT_STEP ? 1 : (int)lround(UPSAMPLING_FIT_STEP / grid->step);
+    upsamplingFit fit;
+    fit.count = (grid->count - 1 + stride - 1) / stride + 1;
+    fit.lower = grid->lower;
+    fit.range = grid->upper - grid->lower;
+    fit.wavelength = (double *)allocAligned(4 * fit.count * sizeof(double));
+    fit.x = fit.wavelength + fit.count;
+    fit.y = fit.x + fit.count;
+    fit.z = fit.y + fit.count;
+
+    // trapezoid weights over every stride-th wavelength of the grid and its last one
+    weightedCmf *cmf = getWeightedCmf(ctx, luminaire);
+    double white_y = 0;
+    for(int i = 0; i < fit.count; i++) {
+        int j = i * stride < grid->count - 1 ? i * stride : grid->count - 1;
+        double left = i > 0 ? (j - (i - 1) * stride) * grid->step : 0;
+        double right = i + 1 < fit.count ? ((i + 1) * stride < grid->count - 1 ? stride : grid->count - 1 - j) * grid->step : 0;
+        double weight = (left + right) / 2;
+        fit.wavelength[i] = j * grid->step / fit.range;
+        fit.x[i] = weight * lookupAtIndex(cmf->x, j);
+        fit.y[i] = weight * lookupAtIndex(cmf->y, j);
+        fit.z[i] = weight * lookupAtIndex(cmf->z, j);
+        white_y += fit.y[i];
+    }
+    releaseWeightedCmf(cmf);
+    if(!(white_y > 0)) {
+        free(fit.wavelength);
+        return NULL;
+    }
+
+    fit.white[0] = fit.white[1] = fit.white[2] = 0;
+    for(int i = 0; i < fit.count; i++) {
+        fit.x[i] /= white_y;
+        fit.y[i] /= white_y;
+        fit.z[i] /= white_y;
+        fit.white[0] += fit.x[i];
+        fit.white[1] += fit.y[i];
+        fit.white[2] += fit.z[i];
+    }
+
+    // the inverse of the xyz to srgb matrix, column by column
+    for(int c = 0; c < 3; c++) {
+        double m[3][3], e[3] = {c == 0, c == 1, c == 2}, column[3];
+        for(int r = 0; r < 3; r++) {
+            for(int k = 0; k < 3; k++)
+                m[r][k] = transformation_matrix[r][k];
+        }
+        solve3x3(m, e, column);
+        for(int r = 0; r < 3; r++)
+            fit.rgb_to_xyz[r][c] = column[r];
+    }
+
+    fit.table = createUpsamplingTable(resolution);
+    for(int k = 0; k < resolution; k++)
+        fit.table->scale[k] = smoothstep(smoothstep((double)k / (resolution - 1)));
+
+    parallelFor(getContextPool(ctx, num_threads), 3 * resolution, fitUpsamplingRow, &fit);
+
+    free(fit.wavelength);
+    return fit.table;
+}
+
+// last k with scale[k] <= value, at most resolution - 2
+static int findScaleInterval(const float *scale, const int resolution, const float value) {
+    int low = 0, high = resolution - 2;
+    while(low < high) {
+        int middle = (low + high + 1) / 2;
+        if(scale[middle] <= value)
+            low = middle;
+        else
+            high = middle - 1;
+    }
+    return low;
+}
+
+static void upsampleColour(const spectocolUpsamplingTable *table, const float rgb_in[3], float c[3]) {
+    float rgb[3];
+    for(int k = 0; k < 3; k++)
+        rgb[k] = rgb_in[k] > 0 ? (rgb_in[k] < 1 ? rgb_in[k] : 1) : 0;
+
+    // constant reflectances: sigmoid(c2) = value
+    if(rgb[0] == rgb[1] && rgb[1] == rgb[2]) {
+        double v = fmin(fmax(rgb[0], UPSAMPLING_GREY_MIN), 1 - UPSAMPLING_GREY_MIN);
+        c[0] = 0;
+        c[1] = 0;
+        c[2] = (v - 0.5) / sqrt(v * (1 - v));
+        return;
+    }
+
+    const int res = table->resolution;
+    int largest = rgb[0] >= rgb[1] ? (rgb[0] >= rgb[2] ? 0 : 2) : (rgb[1] >= rgb[2] ? 1 : 2);
+    float z = rgb[largest];
+    float x = rgb[(largest + 1) % 3] / z * (res - 1);
+    float y = rgb[(largest + 2) % 3] / z * (res - 1);
+
+    int xi = x < res - 2 ? (int)x : res - 2;
+    int yi = y < res - 2 ? (int)y : res - 2;
+    int zi = findScaleInterval(table->scale, res, z);
+    float tx = x - xi;
+    float ty = y - yi;
+    float tz = (z - table->scale[zi]) / (table->scale[zi + 1] - table->scale[zi]);
+
+    const size_t dx = 3;
+    const size_t dy = 3 * (size_t)res;
+    const size_t dz = 3 * (size_t)res * res;
+    const float *p = &table->coefficients[3 * ((((size_t)largest * res + zi) * res + yi) * res + xi)];
+    for(int j = 0; j < 3; j++, p++) {
+        float c00 = p[0] + tx * (p[dx] - p[0]);
+        float c01 = p[dy] + tx * (p[dy + dx] - p[dy]);
+        float c10 = p[dz] + tx * (p[dz + dx] - p[dz]);
+        float c11 = p[dz + dy] + tx * (p[dz + dy + dx] - p[dz + dy]);
+        float c0 = c00 + ty * (c01 - c00);
+        float c1 = c10 + ty * (c11 - c10);
+        c[j] = c0 + tz * (c1 - c0);
+    }
+}
+
+// reflectance[i] = sigmoid(c0 wl[i]^2 + c1 wl[i] + c2)
+typedef void (*sigmoidKernel)(const double c[3], const double *wavelength, int count, double *reflectance);
+
+static void evaluateSigmoidScalar(const double c[3], const double *wavelength, int count, double *reflectance) {
+    for(int i = 0; i < count; i++)
+        reflectance[i] = sigmoid((c[0] * wavelength[i] + c[1]) * wavelength[i] + c[2]);
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+static __attribute__((target("avx2")))
+void evaluateSigmoidAvx2(const double c[3], const double *wavelength, int count, double *reflectance) {
+    const __m256d c0 = _mm256_set1_pd(c[0]);
+    const __m256d c1 = _mm256_set1_pd(c[1]);
+    const __m256d c2 = _mm256_set1_pd(c[2]);
+    const __m256d half = _mm256_set1_pd(0.5);
+    const __m256d one = _mm256_set1_pd(1.0);
+
+    int i = 0;
+    for(; i + 4 <= count; i += 4) {
+        __m256d wl = _mm256_loadu_pd(wavelength + i);
+        __m256d x = _mm256_add_pd(_mm256_mul_pd(_mm256_add_pd(_mm256_mul_pd(c0, wl), c1), wl), c2);
+        __m256d root = _mm256_sqrt_pd(_mm256_add_pd(one, _mm256_mul_pd(x, x)));
+        _mm256_storeu_pd(reflectance + i, _mm256_add_pd(half, _mm256_div_pd(_mm256_mul_pd(half, x), root)));
+    }
+    evaluateSigmoidScalar(c, wavelength + i, count - i, reflectance + i);
+}
+
+static __attribute__((target("avx512f")))
+void evaluateSigmoidAvx512(const double c[3], const double *wavelength, int count, double *reflectance) {
+    const __m512d c0 = _mm512_set1_pd(c[0]);
+    const __m512d c1 = _mm512_set1_pd(c[1]);
+    const __m512d c2 = _mm512_set1_pd(c[2]);
+    const __m512d half = _mm512_set1_pd(0.5);
+    const __m512d one = _mm512_set1_pd(1.0);
+
+    int i = 0;
+    for(; i + 8 <= count; i += 8) {
+        __m512d wl = _mm512_loadu_pd(wavelength + i);
+        __m512d x = _mm512_add_pd(_mm512_mul_pd(_mm512_add_pd(_mm512_mul_pd(c0, wl), c1), wl), c2);
+        __m512d root = _mm512_sqrt_pd(_mm512_add_pd(one, _mm512_mul_pd(x, x)));
+        _mm512_storeu_pd(reflectance + i, _mm512_add_pd(half, _mm512_div_pd(_mm512_mul_pd(half, x), root)));
+    }
+    evaluateSigmoidScalar(c, wavelength + i, count - i, reflectance + i);
+}
+#endif
+
+static sigmoidKernel sigmoid_kernel = evaluateSigmoidScalar;
+static pthread_once_t sigmoid_kernel_once = PTHREAD_ONCE_INIT;
+
+static void selectSigmoidKernel(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("avx512f"))
+        sigmoid_kernel = evaluateSigmoidAvx512;
+    else if(__builtin_cpu_supports("avx2"))
+        sigmoid_kernel = evaluateSigmoidAvx2;
+#endif
+}
+
+static void evaluateSigmoid(const float coefficients[3], const double *wavelength, int count, double *reflectance) {
+    pthread_once(&sigmoid_kernel_once, selectSigmoidKernel);
+    const double c[3] = {coefficients[0], coefficients[1], coefficients[2]};
+    sigmoid_kernel(c, wavelength, count, reflectance);
+}
+
+static bool writeUpsamplingTable(const spectocolUpsamplingTable *table, const char *filename) {
+    FILE *table_file = fopen(filename, "wb");
+    if(table_file == NULL) {
+        printf("Upsampling table %s could not be created.\n", filename);
+        return false;
+    }
+    upsamplingHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, UPSAMPLING_MAGIC, sizeof(UPSAMPLING_MAGIC));
+    header.version = UPSAMPLING_VERSION;
+    header.resolution = table->resolution;
+
+    const size_t count = 9 * (size_t)table->resolution * table->resolution * table->resolution;
+    bool ok = fwrite(&header, sizeof(header), 1, table_file) == 1
+              && fwrite(table->scale, sizeof(float), table->resolution, table_file) == (size_t)table->resolution
+              && fwrite(table->coefficients, sizeof(float), count, table_file) == count;
+    if(fclose(table_file) != 0 || !ok) {
+        printf("Error while writing upsampling table %s.\n", filename);
+        return false;
+    }
+    return true;
+}
+
+static spectocolUpsamplingTable *readUpsamplingTable(const char *filename) {
+    FILE *table_file = fopen(filename, "rb");
+    if(table_file == NULL) {
+        printf("Upsampling table %s could not be opened.\n", filename);
+        return NULL;
+    }
+    upsamplingHeader header;
+    if(fread(&header, sizeof(header), 1, table_file) != 1
+       || memcmp(header.magic, UPSAMPLING_MAGIC, sizeof(UPSAMPLING_MAGIC)) != 0
+       || header.version != UPSAMPLING_VERSION
+       || header.resolution < 2 || header.resolution > SPECTOCOL_UPSAMPLING_RESOLUTION_MAX) {
+        printf("Upsampling table %s is invalid or was built by another version.\n", filename);
+        fclose(table_file);
+        return NULL;
+    }
+
+    spectocolUpsamplingTable *table = createUpsamplingTable(header.resolution);
+    const size_t count = 9 * (size_t)table->resolution * table->resolution * table->resolution;
+    bool ok = fread(table->scale, sizeof(float), table->resolution, table_file) == (size_t)table->resolution
+              && fread(table->coefficients, sizeof(float), count, table_file) == count;
+    fclose(table_file);
+    if(!ok) {
+        printf("Upsampling table %s is truncated.\n", filename);
+        deleteUpsamplingTable(table);
+        return NULL;
+    }
+    return table;
+}
+
+// ========================================================
+// library interface, see spectocol.h
+// ========================================================
+spectocolContext *spectocolCreateContext(const char *database_filename, char **data_directories, int directory_count) {
+    return spectocolCreateContextOnGrid(NULL, database_filename, data_directories, directory_count);
+}
+
+spectocolContext *spectocolCreateContextOnGrid(const spectocolGrid *grid, const char *database_filename,
+                                               char **data_directories, int directory_count) {
+    spectocolContext *ctx = createContext(grid);
+    if(!ctx)
+        return NULL;
+    if(!loadTables(ctx, database_filename, data_directories, directory_count)) {
+        spectocolDeleteContext(ctx);
+        return NULL;
+    }
+    return ctx;
+}
+
+void spectocolDeleteContext(spectocolContext *ctx) {
+    if(!ctx)
+        return;
+    if(ctx->pool)
+        deleteThreadPool(ctx->pool);
+    closeResultSink(ctx->results);
+    deleteWeightedCmfCache(ctx);
+    deleteRegistry(&ctx->registry);
+    unloadDatabase(ctx);
+    pthread_mutex_destroy(&ctx->registry.lock);
+    pthread_mutex_destroy(&ctx->weighted_cmf_lock);
+    pthread_mutex_destroy(&ctx->pool_lock);
+    free(ctx);
+}
+
+void spectocolSetIntermediateResults(spectocolContext *ctx, bool enabled) {
+    spectocolSetResultSink(ctx, enabled ? DEFAULT_RESULTS_DIRECTORY : NULL, SPECTOCOL_RESULTS_TEXT);
+}
+
+void spectocolSetResultSink(spectocolContext *ctx, const char *directory, spectocolResultFormat format) {
+    closeResultSink(ctx->results);
+    ctx->results = directory ? createResultSink(directory, format) : NULL;
+}
+
+void spectocolSetSequence(spectocolContext *ctx, spectocolSequence sequence) {
+    ctx->sequence = sequence;
+}
+
+void spectocolSetImportance(spectocolContext *ctx, spectocolImportance importance) {
+    ctx->importance = importance;
+}
+
+void spectocolSetSeed(spectocolContext *ctx, uint64_t seed) {
+    ctx->seed = seed;
+    __atomic_store_n(&ctx->single_conversions, 0, __ATOMIC_RELAXED);
+}
+
+const spectocolSpectrum *spectocolFindSpectrum(spectocolContext *ctx, const char *name, spectocolKind kind) {
+    return getSpectrum(&ctx->registry, name, kind);
+}
+
+void spectocolPrintSpectra(spectocolContext *ctx) {
+    pthread_mutex_lock(&ctx->registry.lock);
+    printAvailableSpectra(&ctx->registry);
+    pthread_mutex_unlock(&ctx->registry.lock);
+}
+
+spectocolSpectrum *spectocolCreateSpectrum(spectocolContext *ctx, const double *wavelength, const double *intensity,
+                                           int count) {
+    spectrum *table = createGridSpectrum(&ctx->registry.grid);
+    storeSamples(table, wavelength, intensity, count);
+
+    if(!hasSamples(table)) {
+        deleteSpectrum(table);
+        return NULL;
+    }
+    interpolateTableInt(table);
+    return table;
+}
+
+// spectra of a context are deleted with the context
+void spectocolDeleteSpectrum(spectocolSpectrum *spectrum) {
+    if(spectrum && !spectrum->registered)
+        deleteSpectrum(spectrum);
+}
+
+// a conversion whose pseudo random numbers come from stream, a batch uses the index of the request
+static spectocolStatus convertSpectrum(spectocolContext *ctx, spectocolMethod method, int num_samples,
+                                       const spectocolSpectrum *luminaire, const spectocolSpectrum *reflectance,
+                                       const uint64_t stream, float xyz[3], float rgb[3]) {
+    if(!luminaire || !reflectance || !isOnGrid(luminaire, &ctx->registry.grid)
+       || !isOnGrid(reflectance, &ctx->registry.grid))
+        return SPECTOCOL_INVALID_SPECTRUM;
+
+    float cie[3];
+    switch(method) {
+        case SPECTOCOL_FIXED:
+            if(num_samples < 2 || num_samples > FIXED_SAMPLES_MAX || getFixedStride(&ctx->registry.grid, num_samples) == 0)
+                return SPECTOCOL_INVALID_SAMPLES;
+            fxdSpectrumToXyz(ctx, num_samples, luminaire, reflectance, cie);
+            break;
+
+        case SPECTOCOL_RANDOM:
+            if(num_samples < 1)
+                return SPECTOCOL_INVALID_SAMPLES;
+            rndSpectrumToXyz(ctx, num_samples, luminaire, reflectance, stream, cie);
+            break;
+
+        case SPECTOCOL_HERO:
+            if(num_samples < 1)
+                return SPECTOCOL_INVALID_SAMPLES;
+            heroSpectrumToXyz(ctx, num_samples, luminaire, reflectance, stream, cie);
+            break;
+
+        default:
+            return SPECTOCOL_INVALID_METHOD;
+    }
+
+    if(xyz)
+        memcpy(xyz, cie, sizeof(cie));
+    if(rgb)
+        convertToRgb(cie, rgb);
+    return SPECTOCOL_OK;
+}
+
+spectocolStatus spectocolConvert(spectocolContext *ctx, spectocolMethod method, int num_samples,
+                                 const spectocolSpectrum *luminaire, const spectocolSpectrum *reflectance,
+                                 float xyz[3], float rgb[3]) {
+    return convertSpectrum(ctx, method, num_samples, luminaire, reflectance, getSingleStream(ctx), xyz, rgb);
+}
+
+spectocolStatus spectocolConvertToTarget(spectocolContext *ctx, const spectocolSpectrum *luminaire,
+                                         const spectocolSpectrum *reflectance, double target_error,
+                                         double target_delta_e, long max_samples, spectocolEstimate *estimate) {
+    if(!luminaire || !reflectance || !isOnGrid(luminaire, &ctx->registry.grid)
+       || !isOnGrid(reflectance, &ctx->registry.grid))
+        return SPECTOCOL_INVALID_SPECTRUM;
+    if(max_samples == 0)
+        max_samples = SPECTOCOL_STREAM_SAMPLES_MAX;
+    if(max_samples < 1)
+        return SPECTOCOL_INVALID_SAMPLES;
+
+    streamSpectrumToXyz(ctx, luminaire, reflectance, target_error, target_delta_e, max_samples, getSingleStream(ctx),
+                        estimate);
+    convertToRgb(estimate->xyz, estimate->rgb);
+    return SPECTOCOL_OK;
+}
+
+typedef struct requestBatch {
+    spectocolContext *ctx;
+    spectocolRequest *requests;
+} requestBatch;
+
+// task for the thread pool: convert request number index
+static void convertRequest(void *context, int index) {
+    requestBatch *batch = (requestBatch *)context;
+    spectocolRequest *request = &batch->requests[index];
+    request->status = convertSpectrum(batch->ctx, request->method, request->num_samples,
+                                      request->luminaire, request->reflectance, index, request->xyz, request->rgb);
+}
+
+void spectocolConvertBatch(spectocolContext *ctx, spectocolRequest *requests, int count, int num_threads) {
+    requestBatch batch = {ctx, requests};
+    parallelFor(getContextPool(ctx, num_threads), count, convertRequest, &batch);
+}
+
+const char *spectocolStatusMessage(spectocolStatus status) {
+    switch(status) {
+        case SPECTOCOL_OK:
+            return "ok";
+        case SPECTOCOL_INVALID_METHOD:
+            return "unknown method";
+        case SPECTOCOL_INVALID_SAMPLES:
+            return "number of samples out of range for the method";
+        case SPECTOCOL_INVALID_SPECTRUM:
+            return "missing luminaire or reflectance";
+    }
+    return "unknown status";
+}
+
+bool spectocolRenderImage(spectocolContext *ctx, const char *header_filename, const char *output_filename,
+                          const spectocolSpectrum *luminaire, int num_threads) {
+    if(!luminaire || !isOnGrid(luminaire, &ctx->registry.grid))
+        return false;
+    return renderHyperspectralImage(ctx, header_filename, output_filename, luminaire, num_threads);
+}
+
+spectocolStatus spectocolConvertAll(spectocolContext *ctx, int num_samples, const spectocolSpectrum **luminaires,
+                                    int luminaire_count, const spectocolSpectrum **reflectances,
+                                    int reflectance_count, float *xyz, float *rgb, int num_threads) {
+    const spectralGrid *grid = &ctx->registry.grid;
+    if(num_samples < 2 || (num_samples > FIXED_SAMPLES_MAX && num_samples != grid->count)
+       || getFixedStride(grid, num_samples) == 0)
+        return SPECTOCOL_INVALID_SAMPLES;
+    for(int m = 0; m < luminaire_count; m++) {
+        if(!luminaires[m] || !isOnGrid(luminaires[m], &ctx->registry.grid))
+            return SPECTOCOL_INVALID_SPECTRUM;
+    }
+    for(int i = 0; i < reflectance_count; i++) {
+        if(!reflectances[i] || !isOnGrid(reflectances[i], &ctx->registry.grid))
+            return SPECTOCOL_INVALID_SPECTRUM;
+    }
+    if(luminaire_count > 0 && reflectance_count > 0)
+        convertAllPairs(ctx, num_samples, luminaires, luminaire_count, reflectances, reflectance_count, xyz, rgb,
+                        num_threads);
+    return SPECTOCOL_OK;
+}
+
+spectocolUpsamplingTable *spectocolCreateUpsamplingTable(spectocolContext *ctx, const spectocolSpectrum *luminaire,
+                                                         int resolution, int num_threads) {
+    if(!luminaire || !isOnGrid(luminaire, &ctx->registry.grid)
+       || resolution < 2 || resolution > SPECTOCOL_UPSAMPLING_RESOLUTION_MAX)
+        return NULL;
+    return fitUpsamplingTable(ctx, luminaire, resolution, num_threads);
+}
+
+bool spectocolSaveUpsamplingTable(const spectocolUpsamplingTable *table, const char *filename) {
+    return writeUpsamplingTable(table, filename);
+}
+
+spectocolUpsamplingTable *spectocolLoadUpsamplingTable(const char *filename) {
+    return readUpsamplingTable(filename);
+}
+
+void spectocolDeleteUpsamplingTable(spectocolUpsamplingTable *table) {
+    deleteUpsamplingTable(table);
+}
+
+void spectocolUpsample(const spectocolUpsamplingTable *table, const float *rgb, int count, float *coefficients) {
+    for(int i = 0; i < count; i++)
+        upsampleColour(table, rgb + 3 * i, coefficients + 3 * i);
+}
+
+void spectocolEvaluateUpsampled(const float coefficients[3], const double *wavelength, int count,
+                                double *reflectance) {
+    evaluateSigmoid(coefficients, wavelength, count, reflectance);
+}
+
+spectocolSpectrum *spectocolCreateUpsampledSpectrum(spectocolContext *ctx, const float coefficients[3]) {
+    spectrum *table = createGridSpectrum(&ctx->registry.grid);
+    arena *a = getThreadArena();
+    arenaMark mark = arenaSave(a);
+    double *wavelength = (double *)arenaAlloc(a, table->count * sizeof(double));
+    for(int i = 0; i < table->count; i++)
+        wavelength[i] = ctx->registry.grid.lower + i * ctx->registry.grid.step;
+    evaluateSigmoid(coefficients, wavelength, table->count, table->intensity);
+    arenaRestore(a, mark);
+    return table;
+}
+
+bool spectocolCompileDatabase(const char *filename, char **data_directories, int directory_count) {
+    return spectocolCompileDatabaseOnGrid(NULL, filename, data_directories, directory_count);
+}
+
+bool spectocolCompileDatabaseOnGrid(const spectocolGrid *grid, const char *filename,
+                                    char **data_directories, int directory_count) {
+    spectocolContext *ctx = createContext(grid);
+    if(!ctx)
+        return false;
+    bool compiled = setUpRegistry(ctx, data_directories, directory_count) && writeDatabase(&ctx->registry, filename);
+    spectocolDeleteContext(ctx);
+    return compiled;
+}
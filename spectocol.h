@@ -0,0 +1,240 @@
+// ======================================================================== //
+// SPECTRAL TO COLOUR CONVERTER - library interface                         //
+// Calculates XYZ and RGB values from spectral information.                 //
+//                                                                          //
+// Author: Sebastian Schimper                                               //
+// ======================================================================== //
+#ifndef SPECTOCOL_H
+#define SPECTOCOL_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#if defined(__GNUC__)
+#define SPECTOCOL_API __attribute__((visibility("default")))
+#else
+#define SPECTOCOL_API
+#endif
+
+#define SPECTOCOL_FIXED_SAMPLES_MAX 50
+#define SPECTOCOL_STREAM_SAMPLES_MAX (1L << 24)
+#define SPECTOCOL_UPSAMPLING_RESOLUTION_MAX 256
+#define SPECTOCOL_UPSAMPLING_RESOLUTION_DEFAULT 64
+
+// a context owns every spectrum it finds in its data directories or database,
+// the cie matching functions, the per-luminaire caches and the worker threads of its
+// parallel calls. Those threads are started by the first parallel call with its num_threads,
+// later calls reuse them and run one after the other, they end with the context.
+// All functions taking a context may be called from several threads at once.
+typedef struct spectocolContext spectocolContext;
+
+// handle of a spectrum, either owned by a context or created by spectocolCreateSpectrum
+typedef struct spectrum spectocolSpectrum;
+
+// the wavelengths in nm every spectrum of a context is stored at: lower, lower + step, ..., upper
+typedef struct spectocolGrid {
+    double lower;
+    double upper;
+    double step;
+} spectocolGrid;
+
+typedef enum spectocolKind {
+    SPECTOCOL_LUMINAIRE,
+    SPECTOCOL_REFLECTANCE,
+    SPECTOCOL_CMF
+} spectocolKind;
+
+typedef enum spectocolMethod {
+    SPECTOCOL_FIXED,
+    SPECTOCOL_RANDOM,
+    SPECTOCOL_HERO
+} spectocolMethod;
+
+// wavelengths of random and hero sampling: pseudo random, or a randomised low discrepancy
+// sequence (owen scrambled sobol, shifted halton in base 3, shifted golden ratio / r2)
+typedef enum spectocolSequence {
+    SPECTOCOL_SEQUENCE_RANDOM,
+    SPECTOCOL_SEQUENCE_SOBOL,
+    SPECTOCOL_SEQUENCE_HALTON,
+    SPECTOCOL_SEQUENCE_R2
+} spectocolSequence;
+
+// pdf random, hero and streaming sampling draw their wavelengths from, weighted by 1 / pdf:
+// uniform, the luminaire, cie_y, cie_x + cie_y + cie_z or luminaire * cie_y. Every pdf is mixed
+// with a quarter of the uniform one; cie_y and luminaire * cie_y still sample Z more sparsely
+typedef enum spectocolImportance {
+    SPECTOCOL_IMPORTANCE_UNIFORM,
+    SPECTOCOL_IMPORTANCE_LUMINAIRE,
+    SPECTOCOL_IMPORTANCE_Y,
+    SPECTOCOL_IMPORTANCE_XYZ,
+    SPECTOCOL_IMPORTANCE_LUMINAIRE_Y
+} spectocolImportance;
+
+// files the sampled functions of a conversion are written to: text (wavelength intensity per
+// line) or binary ("SPCR", uint32 count, uint32 sampled, float start, float step, the float
+// wavelengths if sampled, then the double intensities, little endian)
+typedef enum spectocolResultFormat {
+    SPECTOCOL_RESULTS_TEXT,
+    SPECTOCOL_RESULTS_BINARY
+} spectocolResultFormat;
+
+typedef enum spectocolStatus {
+    SPECTOCOL_OK,
+    SPECTOCOL_INVALID_METHOD,
+    SPECTOCOL_INVALID_SAMPLES,
+    SPECTOCOL_INVALID_SPECTRUM
+} spectocolStatus;
+
+typedef struct spectocolRequest {
+    spectocolMethod method;
+    int num_samples;
+    const spectocolSpectrum *luminaire;
+    const spectocolSpectrum *reflectance;
+    float xyz[3];               // results
+    float rgb[3];
+    spectocolStatus status;
+} spectocolRequest;
+
+// load the spectra of a database file (may be NULL) and of the data directories,
+// ../data if directory_count is 0, onto the grid 380-780nm in 1nm steps.
+// NULL if the cie matching functions are missing
+SPECTOCOL_API spectocolContext *spectocolCreateContext(const char *database_filename,
+                                                       char **data_directories, int directory_count);
+
+// the same on another grid (NULL = default), e.g. 360-830nm for the cie 2006 functions or 5nm
+// steps for previews. Samples missing at either end of the grid are 0. NULL if the grid is invalid
+SPECTOCOL_API spectocolContext *spectocolCreateContextOnGrid(const spectocolGrid *grid, const char *database_filename,
+                                                             char **data_directories, int directory_count);
+SPECTOCOL_API void spectocolDeleteContext(spectocolContext *ctx);
+
+// write the sampled functions of every conversion to ../data/intermediate results, default off
+SPECTOCOL_API void spectocolSetIntermediateResults(spectocolContext *ctx, bool enabled);
+// the same to another directory (NULL = off) and format. The files are written by a background
+// thread, all of them are on disk once the sink is changed or the context is deleted
+SPECTOCOL_API void spectocolSetResultSink(spectocolContext *ctx, const char *directory,
+                                          spectocolResultFormat format);
+
+// sequence the wavelengths of random, hero and streaming sampling are drawn from, default random
+SPECTOCOL_API void spectocolSetSequence(spectocolContext *ctx, spectocolSequence sequence);
+
+// pdf the wavelengths of random, hero and streaming sampling follow, default uniform
+SPECTOCOL_API void spectocolSetImportance(spectocolContext *ctx, spectocolImportance importance);
+
+// seed of the pseudo random numbers and sequence randomisations, default the time of creation.
+// Every single conversion draws from a stream of its own, so repeated conversions are independent;
+// after setting the seed the n-th single conversion of the context always gets the same numbers.
+// A request of a batch draws from the stream of its index, so a batch gives the same results
+// on any number of threads
+SPECTOCOL_API void spectocolSetSeed(spectocolContext *ctx, uint64_t seed);
+
+// find a spectrum by name, NULL if there is none of that kind.
+// The spectrum belongs to the context and lives as long as it does
+SPECTOCOL_API const spectocolSpectrum *spectocolFindSpectrum(spectocolContext *ctx, const char *name,
+                                                             spectocolKind kind);
+
+// print the names of all spectra of the context to stdout
+SPECTOCOL_API void spectocolPrintSpectra(spectocolContext *ctx);
+
+// create a spectrum on the grid of ctx from count wavelength-intensity-pairs, wavelengths in nm.
+// NULL if there is no sample inside the grid
+SPECTOCOL_API spectocolSpectrum *spectocolCreateSpectrum(spectocolContext *ctx, const double *wavelength,
+                                                         const double *intensity, int count);
+SPECTOCOL_API void spectocolDeleteSpectrum(spectocolSpectrum *spectrum);
+
+// convert reflectance under luminaire with num_samples samples, xyz or rgb may be NULL.
+// Both spectra have to be on the grid of ctx
+SPECTOCOL_API spectocolStatus spectocolConvert(spectocolContext *ctx, spectocolMethod method, int num_samples,
+                                               const spectocolSpectrum *luminaire,
+                                               const spectocolSpectrum *reflectance,
+                                               float xyz[3], float rgb[3]);
+
+// convert every request on num_threads threads (0 = one per core), results are stored in the requests
+SPECTOCOL_API void spectocolConvertBatch(spectocolContext *ctx, spectocolRequest *requests, int count,
+                                         int num_threads);
+
+// fixed sampling of every reflectance under every luminaire, computed as one matrix product on
+// num_threads threads (0 = one per core). num_samples is between 2 and SPECTOCOL_FIXED_SAMPLES_MAX,
+// or the number of wavelengths of the grid for the trapezoid rule over every one of them
+// (401 on the default grid). The results of reflectance i under luminaire m are at
+// xyz[3 * (i * luminaire_count + m)] and the same in rgb, either may be NULL. They equal those of
+// spectocolConvert up to rounding
+SPECTOCOL_API spectocolStatus spectocolConvertAll(spectocolContext *ctx, int num_samples,
+                                                  const spectocolSpectrum **luminaires, int luminaire_count,
+                                                  const spectocolSpectrum **reflectances, int reflectance_count,
+                                                  float *xyz, float *rgb, int num_threads);
+
+typedef struct spectocolEstimate {
+    float xyz[3];
+    float rgb[3];
+    float standard_error[3];    // of xyz
+    float delta_e;              // CIELAB distance of one standard error, relative to the luminaire white
+    long num_samples;
+    bool converged;             // a target was reached before max_samples
+} spectocolEstimate;
+
+// random sampling that keeps only running sums: draws samples until the standard error of
+// every xyz component is at most target_error or delta_e is at most target_delta_e
+// (a target <= 0 is ignored), or until max_samples (0 = SPECTOCOL_STREAM_SAMPLES_MAX)
+SPECTOCOL_API spectocolStatus spectocolConvertToTarget(spectocolContext *ctx, const spectocolSpectrum *luminaire,
+                                                       const spectocolSpectrum *reflectance, double target_error,
+                                                       double target_delta_e, long max_samples,
+                                                       spectocolEstimate *estimate);
+
+SPECTOCOL_API const char *spectocolStatusMessage(spectocolStatus status);
+
+// render an ENVI hyperspectral reflectance cube under luminaire to a .ppm (8 bit sRGB)
+// or .pfm (linear) image, the cube is streamed in tiles
+SPECTOCOL_API bool spectocolRenderImage(spectocolContext *ctx, const char *header_filename,
+                                        const char *output_filename, const spectocolSpectrum *luminaire,
+                                        int num_threads);
+
+// rgb to spectrum upsampling (Jakob and Hanika 2019): a linear sRGB colour in [0, 1] becomes the
+// reflectance sigmoid(c0 wl^2 + c1 wl + c2), wl in nm, sigmoid(x) = 1/2 + x / (2 sqrt(1 + x^2)).
+// The coefficients are fitted once per point of a resolution^3 grid for each largest component,
+// upsampling interpolates between them. A table does not depend on the grid of a context
+typedef struct spectocolUpsamplingTable spectocolUpsamplingTable;
+
+// fit a table under luminaire (the white of sRGB is D65) on num_threads threads (0 = one per core),
+// resolution between 2 and SPECTOCOL_UPSAMPLING_RESOLUTION_MAX. NULL if the luminaire is not on the grid
+SPECTOCOL_API spectocolUpsamplingTable *spectocolCreateUpsamplingTable(spectocolContext *ctx,
+                                                                       const spectocolSpectrum *luminaire,
+                                                                       int resolution, int num_threads);
+SPECTOCOL_API bool spectocolSaveUpsamplingTable(const spectocolUpsamplingTable *table, const char *filename);
+SPECTOCOL_API spectocolUpsamplingTable *spectocolLoadUpsamplingTable(const char *filename);
+SPECTOCOL_API void spectocolDeleteUpsamplingTable(spectocolUpsamplingTable *table);
+
+// coefficients (3 per colour) of count rgb triples, components outside of [0, 1] are clamped
+SPECTOCOL_API void spectocolUpsample(const spectocolUpsamplingTable *table, const float *rgb, int count,
+                                     float *coefficients);
+// reflectance of coefficients at count wavelengths in nm, vectorised
+SPECTOCOL_API void spectocolEvaluateUpsampled(const float coefficients[3], const double *wavelength, int count,
+                                              double *reflectance);
+// the reflectance of coefficients on the grid of ctx, delete it with spectocolDeleteSpectrum
+SPECTOCOL_API spectocolSpectrum *spectocolCreateUpsampledSpectrum(spectocolContext *ctx,
+                                                                  const float coefficients[3]);
+
+// compile the text files of the data directories into a database file
+SPECTOCOL_API bool spectocolCompileDatabase(const char *filename, char **data_directories, int directory_count);
+// the same on another grid (NULL = default), the database can only be loaded by contexts on that grid
+SPECTOCOL_API bool spectocolCompileDatabaseOnGrid(const spectocolGrid *grid, const char *filename,
+                                                  char **data_directories, int directory_count);
+
+// the per-thread scratch memory of all contexts: statistics and release at exit, the memory
+// of threads that are still running is kept until they end
+SPECTOCOL_API void spectocolPrintAllocationStats(void);
+SPECTOCOL_API void spectocolReleaseMemory(void);
+
+// time and count the conversion stages of all contexts (trace file optional, NULL = none),
+// enable before the context is created to include the file reads. The summary is json on stderr
+SPECTOCOL_API void spectocolEnableProfiling(const char *trace_filename);
+SPECTOCOL_API void spectocolWriteProfile(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // SPECTOCOL_H
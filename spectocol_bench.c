@@ -0,0 +1,498 @@
+// ======================================================================== //
+// SPECTRAL TO COLOUR CONVERTER - benchmarks                                //
+// Times every stage of the converter on its own and whole conversions.    //
+// The library is compiled into this file, so its internal functions can   //
+// be benchmarked directly.                                                 //
+//                                                                          //
+// Author: Sebastian Schimper                                               //
+// ======================================================================== //
+#include "spectocol.c"
+
+#include <getopt.h>
+#include <errno.h>
+
+// ========================================================
+// harness - a benchmark runs its operation in batches that
+// double in size until a batch takes at least min_time,
+// the last batch is reported. Allocations are counted on
+// the heap (glibc only) and in the arena of the thread
+// ========================================================
+#define BENCH_MIN_TIME_DEFAULT 0.05
+#define BENCH_ITERATIONS_MAX (1L << 30)
+#define BENCH_LOOKUPS 1024
+
+typedef void (*benchFunction)(void *arg, long iterations);
+
+typedef struct benchOptions {
+    double min_time;        // seconds per benchmark
+    const char *filter;     // only benchmarks whose name contains it, NULL = all
+    bool csv;
+} benchOptions;
+
+static benchOptions options = {BENCH_MIN_TIME_DEFAULT, NULL, false};
+
+// results are written here, so the compiler can't drop the benchmarked work
+static volatile double bench_sink;
+
+// heap allocations of all threads, counted by wrapping the allocator of glibc
+static unsigned long heap_allocations = 0;
+
+#if defined(__GLIBC__)
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t count, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+extern void *__libc_memalign(size_t alignment, size_t size);
+
+void *malloc(size_t size) {
+    __atomic_fetch_add(&heap_allocations, 1, __ATOMIC_RELAXED);
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t count, size_t size) {
+    __atomic_fetch_add(&heap_allocations, 1, __ATOMIC_RELAXED);
+    return __libc_calloc(count, size);
+}
+
+void *realloc(void *ptr, size_t size) {
+    __atomic_fetch_add(&heap_allocations, 1, __ATOMIC_RELAXED);
+    return __libc_realloc(ptr, size);
+}
+
+int posix_memalign(void **ptr, size_t alignment, size_t size) {
+    __atomic_fetch_add(&heap_allocations, 1, __ATOMIC_RELAXED);
+    *ptr = __libc_memalign(alignment, size);
+    return *ptr ? 0 : ENOMEM;
+}
+#endif
+
+static double getSeconds(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec * 1e-9;
+}
+
+static void printBenchHeader(void) {
+    if(options.csv)
+        printf("benchmark,iterations,ns_per_op,items_per_op,items_per_second,heap_allocs_per_op,"
+               "arena_allocs_per_op,arena_bytes_per_op\n");
+    else
+        printf("%-44s %12s %14s %16s %10s %12s %14s\n", "benchmark", "iterations", "ns/op", "items/s",
+               "allocs/op", "arena/op", "arena bytes/op");
+}
+
+// items_per_op is the number of items (samples, characters, ...) one operation handles
+static void runBenchmark(const char *name, benchFunction function, void *arg, const long items_per_op) {
+    if(options.filter && !strstr(name, options.filter))
+        return;
+
+    arena *a = getThreadArena();
+    function(arg, 1);   // warm up caches and lazily built tables
+
+    long iterations = 1;
+    double elapsed;
+    unsigned long heap, allocations;
+    size_t bytes;
+    while(1) {
+        unsigned long heap_before = __atomic_load_n(&heap_allocations, __ATOMIC_RELAXED);
+        unsigned long allocations_before = a->allocations;
+        size_t bytes_before = a->total_bytes;
+        double start = getSeconds();
+        function(arg, iterations);
+        elapsed = getSeconds() - start;
+        heap = __atomic_load_n(&heap_allocations, __ATOMIC_RELAXED) - heap_before;
+        allocations = a->allocations - allocations_before;
+        bytes = a->total_bytes - bytes_before;
+        if(elapsed >= options.min_time || iterations >= BENCH_ITERATIONS_MAX)
+            break;
+        iterations *= 2;
+    }
+
+    double ns_per_op = elapsed * 1e9 / iterations;
+    double items_per_second = items_per_op * iterations / elapsed;
+    if(options.csv)
+        printf("%s,%ld,%.2f,%ld,%.0f,%.2f,%.2f,%.1f\n", name, iterations, ns_per_op, items_per_op, items_per_second,
+               (double)heap / iterations, (double)allocations / iterations, (double)bytes / iterations);
+    else
+        printf("%-44s %12ld %14.2f %16.0f %10.2f %12.2f %14.1f\n", name, iterations, ns_per_op, items_per_second,
+               (double)heap / iterations, (double)allocations / iterations, (double)bytes / iterations);
+    fflush(stdout);
+}
+
+// ========================================================
+// stage benchmarks
+// ========================================================
+typedef struct stageArgs {
+    spectocolContext *ctx;
+    const char *path;           // data file of cie_x
+    size_t file_size;
+    spectrum *raw;              // cie_x as read, before interpolation
+    spectrum *table;            // cie_x interpolated
+    spectrum *other;            // cie_y interpolated
+    double *positions;          // random wavelengths inside the grid
+    int *indices;               // random indices into the grid
+    spectocolSequence sequence;
+} stageArgs;
+
+static void benchReadFile(void *arg, long iterations) {
+    stageArgs *s = (stageArgs *)arg;
+    for(long i = 0; i < iterations; i++) {
+        spectrum *table = createGridSpectrum(&s->ctx->registry.grid);
+        readFile((char *)s->path, table);
+        bench_sink = table->intensity[0];
+        deleteSpectrum(table);
+    }
+}
+
+static void benchInterpolate(void *arg, long iterations) {
+    stageArgs *s = (stageArgs *)arg;
+    spectrum *table = createGridSpectrum(&s->ctx->registry.grid);
+    for(long i = 0; i < iterations; i++) {
+        memcpy(table->intensity, s->raw->intensity, table->count * sizeof(double));
+        interpolateTableInt(table);
+        bench_sink = table->intensity[table->count / 2];
+    }
+    deleteSpectrum(table);
+}
+
+static void benchLookupAtIndex(void *arg, long iterations) {
+    stageArgs *s = (stageArgs *)arg;
+    double sum = 0;
+    for(long i = 0; i < iterations; i++) {
+        for(int k = 0; k < BENCH_LOOKUPS; k++)
+            sum += lookupAtIndex(s->table, s->indices[k]);
+    }
+    bench_sink = sum;
+}
+
+static void benchInterpolateAtWl(void *arg, long iterations) {
+    stageArgs *s = (stageArgs *)arg;
+    double sum = 0;
+    for(long i = 0; i < iterations; i++) {
+        for(int k = 0; k < BENCH_LOOKUPS; k++)
+            sum += interpolateAtWl(s->table, s->positions[k]);
+    }
+    bench_sink = sum;
+}
+
+static void benchSampler(void *arg, long iterations) {
+    stageArgs *s = (stageArgs *)arg;
+    wavelengthSampler sampler;
+    initSampler(&sampler, s->sequence, 1, 0, 0);
+    int sum = 0;
+    for(long i = 0; i < iterations; i++) {
+        for(int k = 0; k < BENCH_LOOKUPS; k++)
+            sum += getNextGridIndex(&sampler, s->table->count);
+    }
+    bench_sink = sum;
+}
+
+static void benchPointwiseMultiplication(void *arg, long iterations) {
+    stageArgs *s = (stageArgs *)arg;
+    for(long i = 0; i < iterations; i++) {
+        spectrum *product = pointwiseMultipication(s->table, s->other);
+        bench_sink = product->intensity[0];
+        deleteSpectrum(product);
+    }
+}
+
+static void benchIntegrateUniform(void *arg, long iterations) {
+    stageArgs *s = (stageArgs *)arg;
+    for(long i = 0; i < iterations; i++)
+        bench_sink = integrate_uniform(s->table, s->table->step);
+}
+
+static void benchDotXyz(void *arg, long iterations) {
+    stageArgs *s = (stageArgs *)arg;
+    double xyz[3];
+    for(long i = 0; i < iterations; i++) {
+        dotXyz(s->table->intensity, s->other->intensity, s->table->intensity, s->other->intensity,
+               s->table->count, xyz);
+        bench_sink = xyz[0];
+    }
+}
+
+static void benchConvertToRgb(void *arg, long iterations) {
+    (void)arg;
+    float cie[3] = {0.4f, 0.35f, 0.2f};
+    float rgb[3];
+    for(long i = 0; i < iterations; i++) {
+        cie[0] += 1e-7f;
+        convertToRgb(cie, rgb);
+        bench_sink = rgb[0];
+    }
+}
+
+static void runStageBenchmarks(spectocolContext *ctx) {
+    registryEntry *entry = findEntry(&ctx->registry, "cie_x");
+    if(entry == NULL || entry->path == NULL) {
+        printf("The stage benchmarks need the text file of cie_x.\n");
+        return;
+    }
+
+    stageArgs s;
+    memset(&s, 0, sizeof(s));
+    s.ctx = ctx;
+    s.path = entry->path;
+    char *buffer = readWholeFile(entry->path, &s.file_size);
+    free(buffer);
+
+    const spectralGrid *grid = &ctx->registry.grid;
+    s.raw = createGridSpectrum(grid);
+    readFile((char *)s.path, s.raw);
+    s.table = ctx->cie_x;
+    s.other = ctx->cie_y;
+
+    s.positions = (double *)malloc(BENCH_LOOKUPS * sizeof(double));
+    s.indices = (int *)malloc(BENCH_LOOKUPS * sizeof(int));
+    unsigned int seed = 1;
+    for(int k = 0; k < BENCH_LOOKUPS; k++) {
+        s.indices[k] = rand_r(&seed) % grid->count;
+        s.positions[k] = grid->lower + (grid->upper - grid->lower) * rand_r(&seed) / ((double)RAND_MAX + 1);
+    }
+
+    runBenchmark("stage/readFile", benchReadFile, &s, (long)s.file_size);
+    runBenchmark("stage/interpolateTableInt", benchInterpolate, &s, grid->count);
+    runBenchmark("stage/lookupAtIndex", benchLookupAtIndex, &s, BENCH_LOOKUPS);
+    runBenchmark("stage/interpolateAtWl", benchInterpolateAtWl, &s, BENCH_LOOKUPS);
+
+    const char *sequences[] = {"random", "sobol", "halton", "r2"};
+    for(int i = 0; i < 4; i++) {
+        char name[64];
+        snprintf(name, sizeof(name), "stage/sample/%s", sequences[i]);
+        s.sequence = (spectocolSequence)i;
+        runBenchmark(name, benchSampler, &s, BENCH_LOOKUPS);
+    }
+
+    runBenchmark("stage/pointwiseMultipication", benchPointwiseMultiplication, &s, grid->count);
+    runBenchmark("stage/integrate_uniform", benchIntegrateUniform, &s, grid->count);
+    runBenchmark("stage/dotXyz", benchDotXyz, &s, grid->count);
+    runBenchmark("stage/convertToRgb", benchConvertToRgb, &s, 1);
+
+    deleteSpectrum(s.raw);
+    free(s.positions);
+    free(s.indices);
+}
+
+// ========================================================
+// end-to-end benchmarks - every luminaire with every
+// reflectance, for a sweep of sample counts per method
+// ========================================================
+typedef struct conversionArgs {
+    spectocolContext *ctx;
+    spectocolMethod method;
+    int num_samples;
+    const spectrum *luminaire;
+    const spectrum *reflectance;
+} conversionArgs;
+
+static void benchConversion(void *arg, long iterations) {
+    conversionArgs *c = (conversionArgs *)arg;
+    float xyz[3];
+    for(long i = 0; i < iterations; i++) {
+        spectocolConvert(c->ctx, c->method, c->num_samples, c->luminaire, c->reflectance, xyz, NULL);
+        bench_sink = xyz[1];
+    }
+}
+
+// names of the spectra of one kind, sorted, without aliases
+static int collectSpectra(spectocolContext *ctx, const spectocolKind kind, registryEntry ***entries) {
+    spectrumRegistry *registry = &ctx->registry;
+    *entries = (registryEntry **)malloc((registry->count + 1) * sizeof(registryEntry *));
+    int count = 0;
+    for(int i = 0; i < registry->bucket_count; i++) {
+        for(registryEntry *entry = registry->buckets[i]; entry != NULL; entry = entry->next) {
+            if(entry->kind == kind && entry->alias_of == NULL)
+                (*entries)[count++] = entry;
+        }
+    }
+    qsort(*entries, count, sizeof(registryEntry *), compareEntryNames);
+    return count;
+}
+
+static void runConversionBenchmarks(spectocolContext *ctx) {
+    static const int fixed_samples[] = {5, 11, 41};
+    static const int random_samples[] = {16, 256, 4096, 65536};
+    const struct { spectocolMethod method; const char *name; const int *samples; int count; } sweeps[] = {
+            {SPECTOCOL_FIXED, "fixed", fixed_samples, 3},
+            {SPECTOCOL_RANDOM, "random", random_samples, 4},
+            {SPECTOCOL_HERO, "hero", random_samples, 4},
+    };
+
+    registryEntry **luminaires, **reflectances;
+    int luminaire_count = collectSpectra(ctx, SPECTOCOL_LUMINAIRE, &luminaires);
+    int reflectance_count = collectSpectra(ctx, SPECTOCOL_REFLECTANCE, &reflectances);
+
+    for(int l = 0; l < luminaire_count; l++) {
+        for(int r = 0; r < reflectance_count; r++) {
+            conversionArgs c;
+            c.ctx = ctx;
+            c.luminaire = getSpectrum(&ctx->registry, luminaires[l]->name, SPECTOCOL_LUMINAIRE);
+            c.reflectance = getSpectrum(&ctx->registry, reflectances[r]->name, SPECTOCOL_REFLECTANCE);
+            if(!c.luminaire || !c.reflectance)
+                continue;
+
+            for(size_t m = 0; m < sizeof(sweeps) / sizeof(sweeps[0]); m++) {
+                for(int n = 0; n < sweeps[m].count; n++) {
+                    char name[128];
+                    c.method = sweeps[m].method;
+                    c.num_samples = sweeps[m].samples[n];
+                    snprintf(name, sizeof(name), "convert/%s/%d/%s/%s", sweeps[m].name, c.num_samples,
+                             luminaires[l]->name, reflectances[r]->name);
+                    runBenchmark(name, benchConversion, &c, c.num_samples);
+                }
+            }
+        }
+    }
+    free(luminaires);
+    free(reflectances);
+}
+
+// ========================================================
+// all pairs benchmarks - the reflectances repeated to a
+// library of ALL_PAIRS_REFLECTANCES under every luminaire,
+// as one matrix product and pair by pair
+// ========================================================
+#define ALL_PAIRS_REFLECTANCES 4096
+
+typedef struct allPairsArgs {
+    spectocolContext *ctx;
+    int num_samples;
+    const spectrum **luminaires;
+    int luminaire_count;
+    const spectrum **reflectances;
+    float *xyz;
+    float *rgb;
+} allPairsArgs;
+
+static void benchAllPairs(void *arg, long iterations) {
+    allPairsArgs *p = (allPairsArgs *)arg;
+    for(long i = 0; i < iterations; i++) {
+        spectocolConvertAll(p->ctx, p->num_samples, p->luminaires, p->luminaire_count, p->reflectances,
+                            ALL_PAIRS_REFLECTANCES, p->xyz, p->rgb, 1);
+        bench_sink = p->xyz[1];
+    }
+}
+
+static void benchPairByPair(void *arg, long iterations) {
+    allPairsArgs *p = (allPairsArgs *)arg;
+    for(long i = 0; i < iterations; i++) {
+        for(int r = 0; r < ALL_PAIRS_REFLECTANCES; r++) {
+            for(int m = 0; m < p->luminaire_count; m++) {
+                float *out = p->xyz + 3 * ((size_t)r * p->luminaire_count + m);
+                spectocolConvert(p->ctx, SPECTOCOL_FIXED, p->num_samples, p->luminaires[m], p->reflectances[r],
+                                 out, p->rgb + (out - p->xyz));
+            }
+        }
+        bench_sink = p->xyz[1];
+    }
+}
+
+static void runAllPairsBenchmarks(spectocolContext *ctx) {
+    static const int fixed_samples[] = {5, 11, 41};
+
+    registryEntry **luminaires, **reflectances;
+    int luminaire_count = collectSpectra(ctx, SPECTOCOL_LUMINAIRE, &luminaires);
+    int reflectance_count = collectSpectra(ctx, SPECTOCOL_REFLECTANCE, &reflectances);
+
+    allPairsArgs p;
+    p.ctx = ctx;
+    p.luminaires = (const spectrum **)malloc((luminaire_count + 1) * sizeof(spectrum *));
+    p.reflectances = (const spectrum **)malloc(ALL_PAIRS_REFLECTANCES * sizeof(spectrum *));
+    p.luminaire_count = 0;
+    for(int l = 0; l < luminaire_count; l++) {
+        const spectrum *luminaire = getSpectrum(&ctx->registry, luminaires[l]->name, SPECTOCOL_LUMINAIRE);
+        if(luminaire)
+            p.luminaires[p.luminaire_count++] = luminaire;
+    }
+    int loaded = 0;
+    for(int r = 0; r < reflectance_count; r++) {
+        const spectrum *reflectance = getSpectrum(&ctx->registry, reflectances[r]->name, SPECTOCOL_REFLECTANCE);
+        if(reflectance)
+            p.reflectances[loaded++] = reflectance;
+    }
+
+    if(p.luminaire_count > 0 && loaded > 0) {
+        for(int r = loaded; r < ALL_PAIRS_REFLECTANCES; r++)
+            p.reflectances[r] = p.reflectances[r % loaded];
+        size_t size = (size_t)ALL_PAIRS_REFLECTANCES * p.luminaire_count * 3 * sizeof(float);
+        p.xyz = (float *)malloc(size);
+        p.rgb = (float *)malloc(size);
+
+        const long pairs = (long)ALL_PAIRS_REFLECTANCES * p.luminaire_count;
+        for(int n = 0; n < 3; n++) {
+            char name[128];
+            p.num_samples = fixed_samples[n];
+            snprintf(name, sizeof(name), "all-pairs/matrix/%d", p.num_samples);
+            runBenchmark(name, benchAllPairs, &p, pairs);
+            snprintf(name, sizeof(name), "all-pairs/pairwise/%d", p.num_samples);
+            runBenchmark(name, benchPairByPair, &p, pairs);
+        }
+        free(p.xyz);
+        free(p.rgb);
+    }
+    free(p.luminaires);
+    free(p.reflectances);
+    free(luminaires);
+    free(reflectances);
+}
+
+// ========================================================
+// main
+// ========================================================
+static void printBenchHelp(void) {
+    printf("Usage: spectocol_bench [options]\n"
+           "    --csv                      (machine readable output)\n"
+           "    --filter text              (only runs benchmarks whose name contains text, e.g. stage/, hero or all-pairs)\n"
+           "    --min-time s               (seconds each benchmark runs at least, default = %g)\n"
+           "    --data-dir dir             (searches dir for spectra, can be given several times, default = ../data)\n",
+           BENCH_MIN_TIME_DEFAULT);
+}
+
+int main(int argc, char **argv) {
+    char *data_directories[DATA_DIRECTORIES_MAX];
+    int directory_count = 0;
+
+    static struct option long_options[] = {
+            {"csv", no_argument, 0, 'c'},
+            {"filter", required_argument, 0, 'f'},
+            {"min-time", required_argument, 0, 'm'},
+            {"data-dir", required_argument, 0, 'D'},
+            {"help", no_argument, 0, 'h'},
+            {0, 0, 0, 0}
+    };
+
+    int c;
+    while((c = getopt_long(argc, argv, "h", long_options, NULL)) != -1) {
+        switch(c) {
+            case 'c':
+                options.csv = true;
+                break;
+            case 'f':
+                options.filter = optarg;
+                break;
+            case 'm':
+                options.min_time = atof(optarg);
+                break;
+            case 'D':
+                if(directory_count < DATA_DIRECTORIES_MAX)
+                    data_directories[directory_count++] = optarg;
+                break;
+            default:
+                printBenchHelp();
+                return c == 'h' ? 0 : 1;
+        }
+    }
+
+    spectocolContext *ctx = spectocolCreateContext(NULL, data_directories, directory_count);
+    if(!ctx)
+        return 1;
+
+    printBenchHeader();
+    runStageBenchmarks(ctx);
+    runConversionBenchmarks(ctx);
+    runAllPairsBenchmarks(ctx);
+
+    spectocolDeleteContext(ctx);
+    spectocolReleaseMemory();
+    return 0;
+}
@@ -0,0 +1,128 @@
+// ======================================================================== //
+// SPECTRAL TO COLOUR CONVERTER - data embedding                            //
+// Writes the spectra of a data directory as C arrays, which the build      //
+// compiles into the library: the samples of every file and its table      //
+// interpolated onto the default grid. The library is compiled into this    //
+// file, so the tables are read and interpolated exactly as at run time.    //
+//                                                                          //
+// Author: Sebastian Schimper                                               //
+// ======================================================================== //
+#include "spectocol.c"
+
+static const char *kind_names[] = {"SPECTOCOL_LUMINAIRE", "SPECTOCOL_REFLECTANCE", "SPECTOCOL_CMF"};
+
+// write values as the initialiser of a double array, every value round trips exactly
+static void writeArray(FILE *out, const char *name, const int index, const double *values, const int count,
+                       const bool aligned) {
+    fprintf(out, "static const double builtin_%d_%s[%d]%s = {", index, name, count,
+            aligned ? " __attribute__((aligned(CACHE_LINE_SIZE)))" : "");
+    for(int i = 0; i < count; i++)
+        fprintf(out, "%s%.17g", i == 0 ? "\n        " : i % 6 == 0 ? ",\n        " : ", ", values[i]);
+    fprintf(out, "\n};\n");
+}
+
+// the wavelength-intensity-pairs of a data file, in the order of the file
+static int readSamples(const char *filename, double **wavelength, double **intensity) {
+    size_t size;
+    char *buffer = readWholeFile(filename, &size);
+    if(buffer == NULL)
+        return 0;
+
+    int capacity = 64;
+    int count = 0;
+    *wavelength = (double *)malloc(capacity * sizeof(double));
+    *intensity = (double *)malloc(capacity * sizeof(double));
+
+    const char *end = buffer + size;
+    const char *line = buffer;
+    while(line < end) {
+        const char *line_end = memchr(line, '\n', end - line);
+        if(line_end == NULL)
+            line_end = end;
+        double wl, in;
+        if(parseSpectralLine(line, line_end, &wl, &in) == 1) {
+            if(count == capacity) {
+                capacity *= 2;
+                *wavelength = (double *)realloc(*wavelength, capacity * sizeof(double));
+                *intensity = (double *)realloc(*intensity, capacity * sizeof(double));
+            }
+            (*wavelength)[count] = wl;
+            (*intensity)[count] = in;
+            count++;
+        }
+        line = line_end + 1;
+    }
+    free(buffer);
+    return count;
+}
+
+int main(int argc, char **argv) {
+    if(argc != 3) {
+        printf("usage: %s data-directory output.inc\n", argv[0]);
+        return 1;
+    }
+
+    spectocolContext *ctx = createContext(NULL);
+    spectrumRegistry *registry = &ctx->registry;
+    scanDataDirectory(registry, argv[1]);
+
+    // sorted by name, so the output only changes with the data
+    registryEntry **entries = (registryEntry **)malloc((registry->count + 1) * sizeof(registryEntry *));
+    int count = 0;
+    for(int i = 0; i < registry->bucket_count; i++) {
+        for(registryEntry *entry = registry->buckets[i]; entry != NULL; entry = entry->next)
+            entries[count++] = entry;
+    }
+    qsort(entries, count, sizeof(registryEntry *), compareEntryNames);
+
+    FILE *out = fopen(argv[2], "w");
+    if(out == NULL) {
+        printf("Output file %s could not be created.\n", argv[2]);
+        return 1;
+    }
+
+    const spectralGrid *grid = &registry->grid;
+    fprintf(out, "// generated by spectocol_embed from %s, do not edit\n", argv[1]);
+    fprintf(out, "#define BUILTIN_GRID_LOWER %.17g\n", grid->lower);
+    fprintf(out, "#define BUILTIN_GRID_STEP %.17g\n", grid->step);
+    fprintf(out, "#define BUILTIN_GRID_COUNT %d\n\n", grid->count);
+
+    int embedded = 0;
+    bool ok = true;
+    for(int i = 0; i < count && ok; i++) {
+        spectrum *table = getSpectrum(registry, entries[i]->name, entries[i]->kind);
+        double *wavelength = NULL;
+        double *intensity = NULL;
+        int samples = readSamples(entries[i]->path, &wavelength, &intensity);
+        if(table == NULL || samples == 0) {
+            printf("Spectrum %s could not be read.\n", entries[i]->name);
+            ok = false;
+        }
+        else {
+            writeArray(out, "wavelength", i, wavelength, samples, false);
+            writeArray(out, "intensity", i, intensity, samples, false);
+            writeArray(out, "table", i, table->intensity, table->count, true);
+            fprintf(out, "\n");
+            embedded++;
+        }
+        free(wavelength);
+        free(intensity);
+    }
+
+    fprintf(out, "static const builtinSpectrum builtin_spectra[] = {\n");
+    for(int i = 0; i < embedded; i++) {
+        fprintf(out, "        {\"%s\", %s, sizeof(builtin_%d_wavelength) / sizeof(double),\n"
+                     "         builtin_%d_wavelength, builtin_%d_intensity, builtin_%d_table},\n",
+                entries[i]->name, kind_names[entries[i]->kind], i, i, i, i);
+    }
+    fprintf(out, "};\n#define BUILTIN_SPECTRUM_COUNT %d\n", embedded);
+
+    free(entries);
+    spectocolDeleteContext(ctx);
+    if(fclose(out) != 0 || !ok) {
+        printf("Error while writing %s.\n", argv[2]);
+        remove(argv[2]);
+        return 1;
+    }
+    return 0;
+}